@@ -0,0 +1,1934 @@
+/***************************************************************************//**
+*  \file       etx_core.c
+*
+*  \details    Shared core of the SSD1306 + AHT20 drivers: bus transport,
+*              OLED framebuffer engine, AHT20 access and periodic sampler.
+*              i2c_driver.c and i2c_client_driver.c are front-ends on top.
+*              Raspberry Pi 4B | Linux 6.12.x
+*
+*******************************************************************************/
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/i2c.h>
+#include <linux/uaccess.h>
+#include <linux/delay.h>
+#include <linux/gpio/consumer.h>
+#include <linux/gpio/machine.h>
+#include <linux/regulator/consumer.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>
+#include <linux/console.h>
+#include <linux/irq_work.h>
+#include <uapi/linux/sched/types.h>
+
+#include "etx_core.h"
+
+/* ===================== CONFIG ===================== */
+#define OLED_ROT_WIDTH      (OLED_PAGES * 8)    /* frame width at 90/270 */
+#define OLED_ROT_PAGES      (OLED_WIDTH / 8)
+#define OLED_CHUNK          32     /* data bytes per I2C write */
+#define OLED_ANIM_MIN_US    25000  /* one full frame at 400 kHz */
+#define OLED_GRAY_MIN_US    2000   /* subframes only send the spans that differ */
+
+#define SAMPLE_ALIGN_NONE   0
+#define SAMPLE_ALIGN_REAL   1
+#define SAMPLE_ALIGN_TAI    2
+
+/* ===================== OLED PARAMS ===================== */
+static bool frame_lock;
+module_param(frame_lock, bool, 0644);
+MODULE_PARM_DESC(frame_lock, "Hold the adapter segment lock across a whole frame flush");
+
+static unsigned int frame_lock_max_us = 20000;
+module_param(frame_lock_max_us, uint, 0644);
+MODULE_PARM_DESC(frame_lock_max_us, "Longest the adapter is held during one frame before yielding (us)");
+
+static unsigned int reset_after_errors = 3;
+module_param(reset_after_errors, uint, 0644);
+MODULE_PARM_DESC(reset_after_errors, "Reset and replay the panel after this many failed flushes in a row (0 = never)");
+
+static char *oled_reset_chip;
+module_param(oled_reset_chip, charp, 0444);
+MODULE_PARM_DESC(oled_reset_chip, "GPIO chip label of the panel reset line when there is no DT node (e.g. pinctrl-bcm2711)");
+
+static int oled_reset_line = -1;
+module_param(oled_reset_line, int, 0444);
+MODULE_PARM_DESC(oled_reset_line, "Line on oled_reset_chip wired to the panel RES# pin (-1 = none)");
+
+#if ETX_CONSOLE
+static bool oled_console;
+module_param(oled_console, bool, 0444);
+MODULE_PARM_DESC(oled_console, "Show the kernel log on the OLED instead of the framebuffer (default off)");
+#endif
+
+/* ===================== SAMPLER PARAMS ===================== */
+static unsigned int sample_period_ms;
+module_param(sample_period_ms, uint, 0444);
+MODULE_PARM_DESC(sample_period_ms, "AHT20 periodic sampling period in ms (0 = only while readers subscribe)");
+
+static bool sampler_kthread;
+module_param(sampler_kthread, bool, 0444);
+MODULE_PARM_DESC(sampler_kthread, "Run the sampler on a dedicated kthread instead of the system workqueue");
+
+static int sampler_cpu = -1;
+module_param(sampler_cpu, int, 0444);
+MODULE_PARM_DESC(sampler_cpu, "Online CPU the sampler kthread is bound to (-1 = any)");
+
+static unsigned int sampler_prio;
+module_param(sampler_prio, uint, 0444);
+MODULE_PARM_DESC(sampler_prio, "SCHED_FIFO priority of the sampler kthread (0 = SCHED_NORMAL)");
+
+static unsigned int sample_align;
+module_param(sample_align, uint, 0444);
+MODULE_PARM_DESC(sample_align, "Align triggers to whole periods of: 0=none, 1=CLOCK_REALTIME, 2=CLOCK_TAI");
+
+static unsigned int sample_offset_ms;
+module_param(sample_offset_ms, uint, 0444);
+MODULE_PARM_DESC(sample_offset_ms, "Offset of aligned triggers from the period boundary in ms");
+
+/* ===================== MEMORY PARAMS ===================== */
+static unsigned int lazy_grace_ms = 30000;
+module_param(lazy_grace_ms, uint, 0644);
+MODULE_PARM_DESC(lazy_grace_ms, "Keep lazily allocated buffers this long after their last user (ms)");
+
+/* ===================== LAZY BUFFERS ===================== */
+
+static void etx_lazy_release(struct work_struct *work)
+{
+    struct etx_lazy *l = container_of(to_delayed_work(work), struct etx_lazy, release);
+
+    mutex_lock(&l->lock);
+    if (!l->users && l->buf) {
+        l->attach(l, NULL);
+        kvfree(l->buf);
+        l->buf = NULL;
+    }
+    mutex_unlock(&l->lock);
+}
+
+void etx_lazy_init(struct etx_lazy *l, size_t size,
+                   void (*attach)(struct etx_lazy *l, void *buf))
+{
+    mutex_init(&l->lock);
+    INIT_DELAYED_WORK(&l->release, etx_lazy_release);
+    l->users  = 0;
+    l->size   = size;
+    l->buf    = NULL;
+    l->attach = attach;
+}
+EXPORT_SYMBOL_GPL(etx_lazy_init);
+
+int etx_lazy_get(struct etx_lazy *l)
+{
+    int ret = 0;
+
+    mutex_lock(&l->lock);
+    /* A release already running blocks on l->lock and then sees a user */
+    cancel_delayed_work(&l->release);
+    if (!l->buf) {
+        l->buf = kvzalloc(l->size, GFP_KERNEL);
+        if (l->buf)
+            l->attach(l, l->buf);
+        else
+            ret = -ENOMEM;
+    }
+    if (!ret)
+        l->users++;
+    mutex_unlock(&l->lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(etx_lazy_get);
+
+void etx_lazy_put(struct etx_lazy *l)
+{
+    mutex_lock(&l->lock);
+    if (!--l->users)
+        mod_delayed_work(system_wq, &l->release, msecs_to_jiffies(lazy_grace_ms));
+    mutex_unlock(&l->lock);
+}
+EXPORT_SYMBOL_GPL(etx_lazy_put);
+
+/* Free now, whatever the grace period; no users may remain */
+void etx_lazy_exit(struct etx_lazy *l)
+{
+    cancel_delayed_work_sync(&l->release);
+    mutex_lock(&l->lock);
+    if (l->buf) {
+        l->attach(l, NULL);
+        kvfree(l->buf);
+        l->buf = NULL;
+    }
+    mutex_unlock(&l->lock);
+}
+EXPORT_SYMBOL_GPL(etx_lazy_exit);
+
+size_t etx_lazy_bytes(struct etx_lazy *l)
+{
+    return READ_ONCE(l->buf) ? l->size : 0;
+}
+EXPORT_SYMBOL_GPL(etx_lazy_bytes);
+
+/* ===================== SHARED BUS ===================== */
+/*
+ * An AHT20 transfer issued on the OLED's adapter while a flush is
+ * running is not sent on its own: it is parked here and appended to
+ * the next flush chunk, so one i2c_transfer() (one adapter lock
+ * round-trip) carries traffic for both addresses.
+ */
+struct bus_req {
+    struct i2c_msg    msg;
+    int               ret;
+    struct completion done;
+};
+
+static struct i2c_client *oled_client;
+static struct i2c_adapter *bus_adap;     /* oled_client's adapter */
+static DEFINE_SPINLOCK(bus_lock);
+static bool bus_flushing;                /* OLED flush in progress */
+static struct bus_req *bus_pending;      /* AHT20 msg waiting for a ride */
+
+/* Frame lock state, only touched by the flusher (under oled_lock) */
+static bool bus_held;
+static ktime_t bus_held_since;
+
+static int bus_ret(int ret, int num)
+{
+    if (ret == num)
+        return 0;
+    return ret < 0 ? ret : -EIO;
+}
+
+/*
+ * Single AHT20 message, batched with the OLED flush when one is running.
+ * Only sensors on the OLED's adapter can ride along.
+ */
+int etx_bus_xfer_aht20(struct i2c_adapter *adap, struct i2c_msg *msg)
+{
+    struct bus_req req = { .msg = *msg };
+
+    spin_lock(&bus_lock);
+    if (adap == bus_adap && bus_flushing && !bus_pending) {
+        init_completion(&req.done);
+        bus_pending = &req;
+        spin_unlock(&bus_lock);
+        wait_for_completion(&req.done);
+        return req.ret;
+    }
+    spin_unlock(&bus_lock);
+
+    return bus_ret(i2c_transfer(adap, msg, 1), 1);
+}
+EXPORT_SYMBOL_GPL(etx_bus_xfer_aht20);
+
+static struct bus_req *bus_take_pending(void)
+{
+    struct bus_req *req;
+
+    spin_lock(&bus_lock);
+    req = bus_pending;
+    bus_pending = NULL;
+    spin_unlock(&bus_lock);
+    return req;
+}
+
+static void bus_complete(struct bus_req *req, int ret)
+{
+    req->ret = ret;
+    complete(&req->done);
+}
+
+static int bus_transfer(struct i2c_msg *msgs, int num)
+{
+    int ret;
+
+    if (bus_held)
+        ret = __i2c_transfer(bus_adap, msgs, num);
+    else
+        ret = i2c_transfer(bus_adap, msgs, num);
+    return bus_ret(ret, num);
+}
+
+/*
+ * With frame_lock set the whole flush runs under one segment lock so
+ * other drivers on the bus cannot interleave and tear the frame. The
+ * hold is bounded: past frame_lock_max_us the lock is dropped for a
+ * moment between chunks.
+ */
+static void bus_frame_lock(void)
+{
+    if (!frame_lock)
+        return;
+    i2c_lock_bus(bus_adap, I2C_LOCK_SEGMENT);
+    bus_held = true;
+    bus_held_since = ktime_get();
+}
+
+static void bus_frame_unlock(void)
+{
+    if (!bus_held)
+        return;
+    bus_held = false;
+    i2c_unlock_bus(bus_adap, I2C_LOCK_SEGMENT);
+}
+
+static void bus_frame_yield(void)
+{
+    if (!bus_held ||
+        ktime_us_delta(ktime_get(), bus_held_since) < frame_lock_max_us)
+        return;
+    i2c_unlock_bus(bus_adap, I2C_LOCK_SEGMENT);
+    cond_resched();
+    i2c_lock_bus(bus_adap, I2C_LOCK_SEGMENT);
+    bus_held_since = ktime_get();
+}
+
+/* One bus cycle: optional OLED command, OLED data, plus any parked AHT20 msg */
+static int bus_xfer_oled(u8 *cmd, int cmd_len, u8 *data, int data_len)
+{
+    struct i2c_msg msgs[3];
+    struct bus_req *req;
+    int n = 0, ret;
+
+    bus_frame_yield();
+
+    if (cmd)
+        msgs[n++] = (struct i2c_msg){ .addr = oled_client->addr,
+                                      .len = cmd_len, .buf = cmd };
+    msgs[n++] = (struct i2c_msg){ .addr = oled_client->addr,
+                                  .len = data_len, .buf = data };
+
+    req = bus_take_pending();
+    if (req)
+        msgs[n++] = req->msg;
+
+    ret = bus_transfer(msgs, n);
+    if (req) {
+        /*
+         * The adapter stops at the first failed message, so an OLED
+         * NACK says nothing about the sensor: give it its own try.
+         */
+        bus_complete(req, ret ? bus_transfer(&req->msg, 1) : 0);
+    }
+    return ret;
+}
+
+static void bus_flush_begin(void)
+{
+    spin_lock(&bus_lock);
+    bus_flushing = true;
+    spin_unlock(&bus_lock);
+
+    bus_frame_lock();
+}
+
+static void bus_flush_end(void)
+{
+    struct bus_req *req;
+
+    bus_frame_unlock();
+
+    spin_lock(&bus_lock);
+    bus_flushing = false;
+    spin_unlock(&bus_lock);
+
+    /* Parked after the last chunk went out: send it on its own */
+    req = bus_take_pending();
+    if (req)
+        bus_complete(req, bus_ret(i2c_transfer(bus_adap, &req->msg, 1), 1));
+}
+
+/* ===================== SSD1306 ===================== */
+
+/* Framebuffers, allocated while someone draws (see etx_oled_get()) */
+struct oled_bufs {
+    u8 fb[OLED_FB_SIZE];                 /* shadow of the panel GDDRAM */
+#if ETX_ROTATE
+    u8 lfb[OLED_FB_SIZE];                /* user frame when rotated 90/270 */
+#endif
+    u8 stage[OLED_FB_SIZE];              /* next panel frame being assembled */
+    u8 replay[OLED_FB_SIZE + 1];         /* control byte + frame for oled_replay() */
+};
+
+static struct etx_lazy oled_mem;
+static u8 *oled_fb, *oled_stage, *oled_replay_buf;
+static u8 *oled_lfb;                     /* NULL when built without ETX_ROTATE */
+static bool oled_fb_stale;               /* shadow does not match the panel */
+static DEFINE_MUTEX(oled_lock);
+
+static unsigned int oled_rotation;       /* OLED_ROTATE_* */
+static unsigned int oled_mirror;         /* OLED_MIRROR_* */
+
+static struct gpio_desc *oled_reset;    /* optional reset-gpios */
+static struct regulator *oled_vdd;       /* optional logic supply */
+static struct regulator *oled_vbat;      /* optional panel supply */
+static bool oled_powered;
+static bool oled_console_on;             /* the console owns the panel */
+static unsigned int oled_powerup_us;     /* last measured power-up latency */
+static unsigned int oled_fail_streak;    /* consecutive failed flushes */
+static struct etx_oled_stats oled_stats;
+
+/* Full init as one command stream; display-on is sent after the frame */
+static const u8 oled_init_cmds[] = {
+    0x00,               /* control byte: commands follow */
+    0xAE,               /* display off */
+    0xD5, 0x80,         /* clock divide / oscillator */
+    0xA8, 0x3F,         /* multiplex ratio 64 */
+    0xD3, 0x00,         /* display offset */
+    0x40,               /* start line 0 */
+    0x8D, 0x14,         /* charge pump on */
+    0x20, 0x00,         /* horizontal addressing */
+    0xA1,               /* segment remap */
+    0xC8,               /* COM scan reversed */
+    0xDA, 0x12,         /* COM pins */
+    0x81, 0x80,         /* contrast */
+    0xD9, 0xF1,         /* pre-charge */
+    0xDB, 0x20,         /* VCOMH */
+    0xA4,               /* display follows RAM */
+    0xA6,               /* normal, not inverted */
+    0x2E,               /* scroll off */
+};
+
+static bool oled_transposed(void)
+{
+    /* Built without rotation the transpose paths below are dead code */
+    if (!ETX_ROTATE)
+        return false;
+    return oled_rotation == OLED_ROTATE_90 || oled_rotation == OLED_ROTATE_270;
+}
+
+/*
+ * Segment/COM remap for the current orientation, relative to the init
+ * table's 0xA1/0xC8. A 90° turn is a transpose plus a horizontal flip,
+ * 270° a transpose plus a vertical flip; user mirrors apply to the
+ * rotated frame, so they swap axes when transposed.
+ */
+static void oled_remap_cmds(u8 cmd[3])
+{
+    bool hflip = oled_rotation == OLED_ROTATE_180 || oled_rotation == OLED_ROTATE_90;
+    bool vflip = oled_rotation == OLED_ROTATE_180 || oled_rotation == OLED_ROTATE_270;
+    unsigned int mx = OLED_MIRROR_X, my = OLED_MIRROR_Y;
+
+    if (oled_transposed())
+        swap(mx, my);
+    hflip ^= !!(oled_mirror & mx);
+    vflip ^= !!(oled_mirror & my);
+
+    cmd[0] = 0x00;
+    cmd[1] = hflip ? 0xA0 : 0xA1;
+    cmd[2] = vflip ? 0xC0 : 0xC8;
+}
+
+#if ETX_CONSOLE
+static void con_replayed(void);
+#else
+static inline void con_replayed(void) {}
+#endif
+
+/* 8x8 bit-matrix transpose: bit j of byte i becomes bit i of byte j */
+static u64 transpose8(u64 x)
+{
+    u64 t;
+
+    t = (x ^ (x >> 7))  & 0x00AA00AA00AA00AAULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+/*
+ * Copy one 8x8 block between a 64-wide user frame @lfb and a 128-wide
+ * panel frame @pfb. @lpage/@pblock index the block in the user frame;
+ * its transpose lands at panel page @pblock, columns lpage*8..+7.
+ */
+static void oled_transpose_block(u8 *lfb, u8 *pfb, unsigned int lpage,
+                                 unsigned int pblock, bool to_panel)
+{
+    u8 *l = &lfb[lpage * OLED_ROT_WIDTH + pblock * 8];
+    u8 *p = &pfb[pblock * OLED_WIDTH + lpage * 8];
+    u8 *src = to_panel ? l : p, *dst = to_panel ? p : l;
+    u64 x = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        x |= (u64)src[i] << (8 * i);
+    x = transpose8(x);
+    for (i = 0; i < 8; i++)
+        dst[i] = x >> (8 * i);
+}
+
+/* Whole 64x128 user frame to panel layout, or back */
+static void oled_transpose_frame(u8 *lfb, u8 *pfb, bool to_panel)
+{
+    unsigned int lp, b;
+
+    for (lp = 0; lp < OLED_ROT_PAGES; lp++)
+        for (b = 0; b < OLED_PAGES; b++)
+            oled_transpose_block(lfb, pfb, lp, b, to_panel);
+}
+
+static void oled_pulse_reset(void)
+{
+    if (!oled_reset)
+        return;
+    gpiod_set_value_cansleep(oled_reset, 1);
+    usleep_range(10, 20);           /* RES# low >= 3 us */
+    gpiod_set_value_cansleep(oled_reset, 0);
+    usleep_range(10, 20);
+}
+
+/*
+ * Init sequence, the whole shadow framebuffer and display-on in a single
+ * i2c_transfer(). Used at probe and to recover a panel that stopped
+ * acking or shows garbage. Caller holds oled_lock.
+ */
+static int oled_replay(void)
+{
+    static u8 window[] = {0x00, 0x21, 0, OLED_WIDTH - 1, 0x22, 0, OLED_PAGES - 1};
+    static u8 display_on[] = {0x00, 0xAF};
+    static u8 remap[3];
+    u8 *frame = oled_replay_buf;
+    struct i2c_msg msgs[] = {
+        { .addr = oled_client->addr, .len = sizeof(oled_init_cmds),
+          .buf = (u8 *)oled_init_cmds },
+        { .addr = oled_client->addr, .len = sizeof(remap), .buf = remap },
+        { .addr = oled_client->addr, .len = sizeof(window), .buf = window },
+        { .addr = oled_client->addr, .len = OLED_FB_SIZE + 1, .buf = frame },
+        { .addr = oled_client->addr, .len = sizeof(display_on), .buf = display_on },
+    };
+    int ret;
+
+    if (frame) {
+        memcpy(&frame[1], oled_fb, OLED_FB_SIZE);
+    } else {
+        /* Nobody is drawing: bring the panel up blank */
+        frame = kzalloc(OLED_FB_SIZE + 1, GFP_KERNEL);
+        if (!frame)
+            return -ENOMEM;
+        msgs[3].buf = frame;
+    }
+    frame[0] = 0x40;
+    oled_remap_cmds(remap);
+
+    ret = bus_transfer(msgs, ARRAY_SIZE(msgs));
+    if (frame != oled_replay_buf)
+        kfree(frame);
+    else if (!ret)
+        oled_fb_stale = false;
+    if (!ret)
+        con_replayed();
+    return ret;
+}
+
+static int oled_recover(void)
+{
+    int ret;
+
+    oled_pulse_reset();
+    ret = oled_replay();
+    /* With the console on, each message would be one more flush to fail */
+    if (!oled_console_on) {
+        if (ret)
+            pr_err_ratelimited("SSD1306: recovery failed (%d)\n", ret);
+        else
+            pr_info_ratelimited("SSD1306: panel recovered\n");
+    }
+    oled_fail_streak = 0;
+    return ret;
+}
+
+/*
+ * Datasheet power-on: VDD, RES# low >= 3 us, VBAT, then commands. The
+ * regulator core already waits out each supply's enable ramp, so no
+ * blanket sleep is needed; the 100 ms tAF after display-on is the panel
+ * lighting up and does not gate the host. Caller holds oled_lock.
+ */
+static int __oled_power_on(void)
+{
+    ktime_t t0 = ktime_get();
+    int ret;
+
+    if (oled_powered)
+        return 0;
+    /* Detached (failed probe, unbind) while the char device stays open */
+    if (!oled_client)
+        return -ENODEV;
+
+    if (oled_vdd) {
+        ret = regulator_enable(oled_vdd);
+        if (ret)
+            return ret;
+    }
+    oled_pulse_reset();
+    if (oled_vbat) {
+        ret = regulator_enable(oled_vbat);
+        if (ret)
+            goto err_vdd;
+    }
+
+    ret = oled_replay();
+    if (ret)
+        goto err_vbat;
+
+    oled_powered = true;
+    oled_fail_streak = 0;
+    oled_powerup_us = ktime_us_delta(ktime_get(), t0);
+    pr_info("SSD1306: powered up in %u us\n", oled_powerup_us);
+    return 0;
+
+err_vbat:
+    if (oled_vbat)
+        regulator_disable(oled_vbat);
+err_vdd:
+    if (oled_vdd)
+        regulator_disable(oled_vdd);
+    return ret;
+}
+
+/* Display off, VBAT off, tOFF (100 ms), VDD off. Caller holds oled_lock. */
+static void __oled_power_off(void)
+{
+    static u8 display_off[] = {0x00, 0xAE};
+    struct i2c_msg msg = { .addr = oled_client->addr,
+                           .len = sizeof(display_off), .buf = display_off };
+
+    if (!oled_powered)
+        return;
+
+    bus_transfer(&msg, 1);
+    if (oled_vbat) {
+        regulator_disable(oled_vbat);
+        if (oled_vdd)
+            msleep(100);
+    }
+    if (oled_vdd)
+        regulator_disable(oled_vdd);
+    oled_powered = false;
+}
+
+int etx_oled_power_on(void)
+{
+    int ret;
+
+    mutex_lock(&oled_lock);
+    ret = __oled_power_on();
+    mutex_unlock(&oled_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(etx_oled_power_on);
+
+void etx_oled_power_off(void)
+{
+    mutex_lock(&oled_lock);
+    __oled_power_off();
+    mutex_unlock(&oled_lock);
+}
+EXPORT_SYMBOL_GPL(etx_oled_power_off);
+
+unsigned int etx_oled_powerup_us(void)
+{
+    return READ_ONCE(oled_powerup_us);
+}
+EXPORT_SYMBOL_GPL(etx_oled_powerup_us);
+
+static void oled_mem_attach(struct etx_lazy *l, void *buf)
+{
+    struct oled_bufs *b = buf;
+
+    mutex_lock(&oled_lock);
+    oled_fb         = b ? b->fb : NULL;
+#if ETX_ROTATE
+    oled_lfb        = b ? b->lfb : NULL;
+#endif
+    oled_stage      = b ? b->stage : NULL;
+    oled_replay_buf = b ? b->replay : NULL;
+    oled_fb_stale   = true;
+    mutex_unlock(&oled_lock);
+}
+
+int etx_oled_get(void)
+{
+    return etx_lazy_get(&oled_mem);
+}
+EXPORT_SYMBOL_GPL(etx_oled_get);
+
+void etx_oled_put(void)
+{
+    etx_lazy_put(&oled_mem);
+}
+EXPORT_SYMBOL_GPL(etx_oled_put);
+
+size_t etx_oled_buffer_bytes(void)
+{
+    return etx_lazy_bytes(&oled_mem);
+}
+EXPORT_SYMBOL_GPL(etx_oled_buffer_bytes);
+
+/* Framebuffer drawing is possible; caller holds oled_lock */
+static int oled_can_draw(void)
+{
+    if (oled_console_on)
+        return -EBUSY;
+    return oled_fb && oled_client ? 0 : -ENODEV;
+}
+
+/* Send columns [x0, x1) of @page from the shadow framebuffer */
+static int oled_flush_span(unsigned int page, unsigned int x0, unsigned int x1)
+{
+    u8 cmd[7] = {0x00, 0x21, x0, x1 - 1, 0x22, page, page};
+    u8 buf[OLED_CHUNK + 1];
+    bool first = true;
+    unsigned int n;
+    int ret;
+
+    buf[0] = 0x40;
+    while (x0 < x1) {
+        n = min(x1 - x0, (unsigned int)OLED_CHUNK);
+        memcpy(&buf[1], &oled_fb[page * OLED_WIDTH + x0], n);
+        /* Column pointer auto-increments, so only the first chunk seeks */
+        ret = bus_xfer_oled(first ? cmd : NULL, sizeof(cmd), buf, n + 1);
+        if (ret)
+            return ret;
+        first = false;
+        x0 += n;
+    }
+    return 0;
+}
+
+static int oled_flush_finish(int ret)
+{
+    if (!ret) {
+        oled_fail_streak = 0;
+    } else if (reset_after_errors && ++oled_fail_streak >= reset_after_errors) {
+        /* The replay carries the whole shadow buffer, this frame included */
+        if (!oled_console_on)
+            pr_warn_ratelimited("SSD1306: %u failed flushes, resetting panel\n",
+                                oled_fail_streak);
+        ret = oled_recover();
+    }
+    bus_flush_end();
+    return ret;
+}
+
+/* Push framebuffer bytes [start, end) to the panel; caller holds oled_lock */
+static int oled_flush_range(unsigned int start, unsigned int end)
+{
+    unsigned int page, x0, x1;
+    int ret = 0;
+
+    /* Powered down: the shadow buffer is replayed at the next power-up */
+    if (!oled_powered)
+        return 0;
+
+    bus_flush_begin();
+    for (page = start / OLED_WIDTH; page <= (end - 1) / OLED_WIDTH; page++) {
+        x0 = page == start / OLED_WIDTH ? start % OLED_WIDTH : 0;
+        x1 = page == (end - 1) / OLED_WIDTH ? (end - 1) % OLED_WIDTH + 1 : OLED_WIDTH;
+        ret = oled_flush_span(page, x0, x1);
+        if (ret)
+            break;
+    }
+    return oled_flush_finish(ret);
+}
+
+/*
+ * Make the panel show @frame (panel layout), sending only the changed
+ * column span of each page. A freshly allocated shadow says nothing
+ * about the panel, so the first frame after it goes out whole. Caller
+ * holds oled_lock.
+ */
+static int oled_present(const u8 *frame)
+{
+    unsigned int page, x0, x1;
+    const u8 *src, *dst;
+    bool full = oled_fb_stale;
+    bool flushing = false;
+    int ret = 0;
+
+    for (page = 0; page < OLED_PAGES; page++) {
+        src = &frame[page * OLED_WIDTH];
+        dst = &oled_fb[page * OLED_WIDTH];
+        if (full) {
+            x0 = 0;
+            x1 = OLED_WIDTH;
+        } else {
+            if (!memcmp(src, dst, OLED_WIDTH))
+                continue;
+            for (x0 = 0; src[x0] == dst[x0]; x0++)
+                ;
+            for (x1 = OLED_WIDTH; src[x1 - 1] == dst[x1 - 1]; x1--)
+                ;
+        }
+        memcpy(&oled_fb[page * OLED_WIDTH + x0], &src[x0], x1 - x0);
+
+        /* After an error keep updating the shadow for the recovery replay */
+        if (!oled_powered || ret)
+            continue;
+        if (!flushing) {
+            bus_flush_begin();
+            flushing = true;
+        }
+        ret = oled_flush_span(page, x0, x1);
+    }
+    if (!flushing)
+        return 0;
+    if (!ret && full)
+        oled_fb_stale = false;
+    return oled_flush_finish(ret);
+}
+
+/*
+ * User frame bytes [start, end) changed; the rest of the next panel
+ * frame is already in oled_stage. When rotated 90/270 the touched rows
+ * of 8x8 blocks are transposed in first. Pages identical to the shadow
+ * are then skipped, so clients rewriting the whole 1 KiB frame only pay
+ * for what actually changed. Caller holds oled_lock.
+ */
+static int oled_commit(unsigned int start, unsigned int end)
+{
+    unsigned int lp, b;
+
+    if (oled_transposed())
+        for (lp = start / OLED_ROT_WIDTH; lp <= (end - 1) / OLED_ROT_WIDTH; lp++)
+            for (b = 0; b < OLED_PAGES; b++)
+                oled_transpose_block(oled_lfb, oled_stage, lp, b, true);
+    return oled_present(oled_stage);
+}
+
+int etx_oled_set_orientation(u32 rotation, u32 mirror)
+{
+    u8 remap[3];
+    struct i2c_msg msg = { .len = sizeof(remap), .buf = remap };
+    bool was_transposed;
+    int ret = 0;
+
+    if (rotation > OLED_ROTATE_270 || mirror & ~(OLED_MIRROR_X | OLED_MIRROR_Y))
+        return -EINVAL;
+    if (!ETX_ROTATE && (rotation == OLED_ROTATE_90 || rotation == OLED_ROTATE_270))
+        return -EOPNOTSUPP;
+
+    mutex_lock(&oled_lock);
+    if (!oled_client) {
+        mutex_unlock(&oled_lock);
+        return -ENODEV;
+    }
+    if (oled_console_on) {
+        mutex_unlock(&oled_lock);
+        return -EBUSY;
+    }
+    msg.addr = oled_client->addr;
+    was_transposed = oled_transposed();
+    oled_rotation = rotation;
+    oled_mirror   = mirror;
+
+    /* Keep the picture: derive the user frame from what the panel shows */
+    if (oled_fb && oled_transposed() && !was_transposed)
+        oled_transpose_frame(oled_lfb, oled_fb, false);
+
+    oled_remap_cmds(remap);
+    if (oled_powered)
+        ret = bus_transfer(&msg, 1);
+
+    /*
+     * COM scan (0xC0/0xC8) flips the panel at once, but segment remap
+     * (0xA0/0xA1) only applies to RAM written afterwards: resend the
+     * whole frame so both axes match.
+     */
+    oled_fb_stale = true;
+    if (!ret && oled_fb) {
+        memcpy(oled_stage, oled_fb, OLED_FB_SIZE);
+        ret = oled_present(oled_stage);
+    }
+    mutex_unlock(&oled_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(etx_oled_set_orientation);
+
+/* Absent supplies are fine: the panel is then powered with the board */
+static struct regulator *oled_get_supply(struct device *dev, const char *id)
+{
+    struct regulator *reg = devm_regulator_get_optional(dev, id);
+
+    if (IS_ERR(reg) && PTR_ERR(reg) == -ENODEV)
+        return NULL;
+    return reg;
+}
+
+/*
+ * A client made from a bare i2c_board_info has no firmware node, so
+ * devm_gpiod_get_optional("reset") only finds a line listed in a lookup
+ * table keyed by the client's device name. Supplies have no such table:
+ * vdd/vbat still need a DT node (or board code).
+ */
+static struct gpiod_lookup_table oled_reset_lookup = {
+    .table = {
+        GPIO_LOOKUP(NULL, 0, "reset", GPIO_ACTIVE_LOW),
+        { },
+    },
+};
+static char oled_reset_dev_id[16];
+static bool oled_reset_listed;
+
+/* Call before creating the panel client at bus/addr */
+void etx_oled_board_add(int bus, unsigned short addr)
+{
+    if (!oled_reset_chip || oled_reset_line < 0 || oled_reset_listed)
+        return;
+
+    snprintf(oled_reset_dev_id, sizeof(oled_reset_dev_id), "%d-%04x", bus, addr);
+    oled_reset_lookup.dev_id = oled_reset_dev_id;
+    oled_reset_lookup.table[0].key = oled_reset_chip;
+    oled_reset_lookup.table[0].chip_hwnum = oled_reset_line;
+    gpiod_add_lookup_table(&oled_reset_lookup);
+    oled_reset_listed = true;
+}
+EXPORT_SYMBOL_GPL(etx_oled_board_add);
+
+/* Call after unregistering the panel client */
+void etx_oled_board_remove(void)
+{
+    if (!oled_reset_listed)
+        return;
+    gpiod_remove_lookup_table(&oled_reset_lookup);
+    oled_reset_listed = false;
+}
+EXPORT_SYMBOL_GPL(etx_oled_board_remove);
+
+/* ===================== OLED CONSOLE ===================== */
+#if ETX_CONSOLE
+/*
+ * Kernel log on the panel, one text line per page. A new line is drawn
+ * into the page that holds the oldest one and the display start line
+ * (0x40 | row) is moved down a page, so the panel scrolls without
+ * touching the other seven. printk may call in atomic context, so
+ * con_write() only queues text; con_work sends it. It is kicked through
+ * an irq_work, as printk defers its own output: printk may run inside
+ * the workqueue code with pool locks held, where queue_work() deadlocks.
+ */
+#define CON_GLYPH_W         6      /* 5 columns plus spacing */
+#define CON_COLS            (OLED_WIDTH / CON_GLYPH_W)
+
+/* 5x7 glyphs for 0x20..0x7E, column bytes with bit 0 at the top */
+static const u8 con_font[][5] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00},
+    {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7F, 0x14, 0x7F, 0x14},
+    {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+    {0x36, 0x49, 0x56, 0x20, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00},
+    {0x00, 0x1C, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1C, 0x00},
+    {0x2A, 0x1C, 0x7F, 0x1C, 0x2A}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+    {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08},
+    {0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+    {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+    {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31},
+    {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39},
+    {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E},
+    {0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00},
+    {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+    {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06},
+    {0x32, 0x49, 0x79, 0x41, 0x3E}, {0x7E, 0x11, 0x11, 0x11, 0x7E},
+    {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+    {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41},
+    {0x7F, 0x09, 0x09, 0x09, 0x01}, {0x3E, 0x41, 0x49, 0x49, 0x7A},
+    {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+    {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41},
+    {0x7F, 0x40, 0x40, 0x40, 0x40}, {0x7F, 0x02, 0x0C, 0x02, 0x7F},
+    {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+    {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E},
+    {0x7F, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31},
+    {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+    {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x3F, 0x40, 0x38, 0x40, 0x3F},
+    {0x63, 0x14, 0x08, 0x14, 0x63}, {0x07, 0x08, 0x70, 0x08, 0x07},
+    {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x00},
+    {0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7F, 0x00},
+    {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},
+    {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},
+    {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20},
+    {0x38, 0x44, 0x44, 0x48, 0x7F}, {0x38, 0x54, 0x54, 0x54, 0x18},
+    {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x0C, 0x52, 0x52, 0x52, 0x3E},
+    {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00},
+    {0x20, 0x40, 0x44, 0x3D, 0x00}, {0x7F, 0x10, 0x28, 0x44, 0x00},
+    {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78},
+    {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},
+    {0x7C, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7C},
+    {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+    {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C},
+    {0x1C, 0x20, 0x40, 0x20, 0x1C}, {0x3C, 0x40, 0x30, 0x40, 0x3C},
+    {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C},
+    {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},
+    {0x00, 0x00, 0x7F, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00},
+    {0x10, 0x08, 0x08, 0x10, 0x08},
+};
+
+static DEFINE_SPINLOCK(con_lock);
+static char con_lines[OLED_PAGES][CON_COLS];    /* last complete lines */
+static unsigned int con_head;            /* next slot in con_lines */
+static unsigned int con_new;             /* lines not on the panel yet */
+static char con_cur[CON_COLS];           /* line being assembled */
+static unsigned int con_col;
+static unsigned int con_top;             /* page shown in the top row; oled_lock */
+
+static void con_work_fn(struct work_struct *work);
+static DECLARE_WORK(con_work, con_work_fn);
+
+static void con_kick_fn(struct irq_work *iw)
+{
+    schedule_work(&con_work);
+}
+static struct irq_work con_kick = IRQ_WORK_INIT(con_kick_fn);
+
+/* Caller holds con_lock */
+static void con_newline(void)
+{
+    memcpy(con_lines[con_head], con_cur, CON_COLS);
+    memset(con_cur, ' ', CON_COLS);
+    con_head = (con_head + 1) % OLED_PAGES;
+    con_col  = 0;
+    if (con_new < OLED_PAGES)
+        con_new++;
+}
+
+/* Long lines wrap; only complete lines are drawn */
+static void con_write(struct console *con, const char *s, unsigned int n)
+{
+    unsigned long flags;
+    bool queued = false;
+
+    spin_lock_irqsave(&con_lock, flags);
+    for (; n; n--, s++) {
+        if (*s == '\n') {
+            con_newline();
+            queued = true;
+            continue;
+        }
+        if (con_col == CON_COLS) {
+            con_newline();
+            queued = true;
+        }
+        con_cur[con_col++] = *s;
+    }
+    spin_unlock_irqrestore(&con_lock, flags);
+
+    if (queued)
+        irq_work_queue(&con_kick);
+}
+
+static struct console con_oled = {
+    .name  = "etx_oled",
+    .write = con_write,
+    .flags = CON_ENABLED,
+    .index = -1,
+};
+
+static void con_render(const char *text, u8 *page)
+{
+    unsigned int i;
+    unsigned char c;
+
+    memset(page, 0, OLED_WIDTH);
+    for (i = 0; i < CON_COLS; i++) {
+        c = text[i];
+        if (c < 0x20)
+            c = ' ';
+        else if (c > 0x7E)
+            c = '?';
+        memcpy(&page[i * CON_GLYPH_W], con_font[c - 0x20], 5);
+    }
+}
+
+/* One page write per new line, then a single start-line move */
+static void con_work_fn(struct work_struct *work)
+{
+    char text[OLED_PAGES][CON_COLS];
+    u8 cmd[7] = {0x00, 0x21, 0, OLED_WIDTH - 1, 0x22, 0, 0};
+    u8 start[2] = {0x00, 0x40};
+    u8 buf[OLED_WIDTH + 1];
+    unsigned long flags;
+    unsigned int n, i;
+    int ret = 0;
+
+    mutex_lock(&oled_lock);
+    if (!oled_console_on || !oled_powered) {
+        mutex_unlock(&oled_lock);
+        return;
+    }
+
+    spin_lock_irqsave(&con_lock, flags);
+    n = con_new;
+    con_new = 0;
+    for (i = 0; i < n; i++)
+        memcpy(text[i], con_lines[(con_head + OLED_PAGES - n + i) % OLED_PAGES], CON_COLS);
+    spin_unlock_irqrestore(&con_lock, flags);
+    if (!n) {
+        mutex_unlock(&oled_lock);
+        return;
+    }
+
+    bus_flush_begin();
+    buf[0] = 0x40;
+    for (i = 0; i < n; i++) {
+        con_render(text[i], &buf[1]);
+        cmd[5] = cmd[6] = con_top;
+        ret = bus_xfer_oled(cmd, sizeof(cmd), buf, sizeof(buf));
+        if (ret)
+            break;
+        con_top = (con_top + 1) % OLED_PAGES;
+    }
+    if (i) {
+        start[1] = 0x40 | (con_top * 8);
+        if (!ret)
+            ret = bus_xfer_oled(NULL, 0, start, sizeof(start));
+    }
+    /* A recovery replay lands in con_replayed() and redraws everything */
+    oled_flush_finish(ret);
+    mutex_unlock(&oled_lock);
+}
+
+/* The init table reset the start line and the frame hid the text */
+static void con_replayed(void)
+{
+    unsigned long flags;
+
+    if (!oled_console_on)
+        return;
+    con_top = 0;
+    spin_lock_irqsave(&con_lock, flags);
+    con_new = OLED_PAGES;
+    spin_unlock_irqrestore(&con_lock, flags);
+    schedule_work(&con_work);
+}
+
+static void con_start(void)
+{
+    if (!oled_console)
+        return;
+
+    memset(con_lines, ' ', sizeof(con_lines));
+    memset(con_cur, ' ', sizeof(con_cur));
+    con_col = 0;
+
+    mutex_lock(&oled_lock);
+    oled_console_on = true;
+    /* Clear the panel on first draw */
+    con_replayed();
+    mutex_unlock(&oled_lock);
+
+    register_console(&con_oled);
+}
+
+/* Hand the panel back; the next frame goes out whole */
+static void con_stop(void)
+{
+    static u8 start0[] = {0x00, 0x40};
+    struct i2c_msg msg = { .len = sizeof(start0), .buf = start0 };
+
+    if (!oled_console_on)
+        return;
+
+    unregister_console(&con_oled);
+    irq_work_sync(&con_kick);
+    cancel_work_sync(&con_work);
+
+    mutex_lock(&oled_lock);
+    oled_console_on = false;
+    if (oled_powered) {
+        msg.addr = oled_client->addr;
+        bus_transfer(&msg, 1);
+    }
+    oled_fb_stale = true;
+    mutex_unlock(&oled_lock);
+}
+#else
+static inline void con_start(void) {}
+static inline void con_stop(void) {}
+#endif /* ETX_CONSOLE */
+
+/* Bind the engine to @client; reset line and supplies are device-managed */
+int etx_oled_attach(struct i2c_client *client)
+{
+    struct gpio_desc *reset;
+    struct regulator *vdd, *vbat;
+
+    reset = devm_gpiod_get_optional(&client->dev, "reset", GPIOD_OUT_LOW);
+    if (IS_ERR(reset))
+        return dev_err_probe(&client->dev, PTR_ERR(reset), "cannot get reset GPIO\n");
+    vdd = oled_get_supply(&client->dev, "vdd");
+    if (IS_ERR(vdd))
+        return dev_err_probe(&client->dev, PTR_ERR(vdd), "cannot get vdd\n");
+    vbat = oled_get_supply(&client->dev, "vbat");
+    if (IS_ERR(vbat))
+        return dev_err_probe(&client->dev, PTR_ERR(vbat), "cannot get vbat\n");
+
+    mutex_lock(&oled_lock);
+    oled_client = client;
+    oled_reset  = reset;
+    oled_vdd    = vdd;
+    oled_vbat   = vbat;
+    mutex_unlock(&oled_lock);
+
+    spin_lock(&bus_lock);
+    bus_adap = client->adapter;
+    spin_unlock(&bus_lock);
+
+    con_start();
+    return 0;
+}
+EXPORT_SYMBOL_GPL(etx_oled_attach);
+
+/* ===================== OLED ANIMATION ===================== */
+#if ETX_ANIM
+/*
+ * A frame sequence is uploaded once and played from an hrtimer. The
+ * timer only kicks a work item (I2C sleeps); the work picks the frame
+ * due at the current time, so a slow bus drops frames instead of
+ * drifting, and presents it as a diff against the shadow buffer.
+ */
+static u8 *anim_frames;                  /* panel layout, anim_count frames */
+static unsigned int anim_count;
+static unsigned int anim_loops;          /* 0 = forever */
+static u64 anim_period_ns;
+static ktime_t anim_start;
+static bool anim_playing;
+static bool anim_sequential;             /* step every tick, never skip */
+static bool anim_has_fb;                 /* holds an etx_oled_get() reference */
+static unsigned int anim_pos;
+static u64 anim_shown;                   /* last index presented + 1, 0 = none */
+static struct hrtimer anim_timer;
+
+static void anim_work_fn(struct work_struct *work);
+static DECLARE_WORK(anim_work, anim_work_fn);
+
+/*
+ * Playback is over: rotated writes resume from what it left on screen.
+ * Returns whether the caller must etx_oled_put() the framebuffers,
+ * which it does after releasing oled_lock: the lazy-buffer lock is
+ * taken before oled_lock (oled_mem_attach). Caller holds oled_lock.
+ */
+static bool anim_release(void)
+{
+    bool had_fb = anim_has_fb;
+
+    if (oled_fb && oled_transposed())
+        oled_transpose_frame(oled_lfb, oled_fb, false);
+    anim_has_fb = false;
+    return had_fb;
+}
+
+static enum hrtimer_restart anim_tick(struct hrtimer *t)
+{
+    /* The work clears anim_playing once the last loop is shown */
+    if (!READ_ONCE(anim_playing))
+        return HRTIMER_NORESTART;
+    queue_work(system_highpri_wq, &anim_work);
+    hrtimer_forward_now(t, ns_to_ktime(anim_period_ns));
+    return HRTIMER_RESTART;
+}
+
+static void anim_work_fn(struct work_struct *work)
+{
+    bool put_fb = false;
+    ktime_t deadline;
+    u64 idx;
+    u32 frame;
+
+    mutex_lock(&oled_lock);
+    if (!anim_playing)
+        goto out;
+
+    /* Grayscale subframes must each get their share of time, in order */
+    if (anim_sequential)
+        idx = anim_pos++;
+    else
+        idx = div64_u64(ktime_to_ns(ktime_sub(ktime_get(), anim_start)), anim_period_ns);
+    if (anim_loops && idx >= (u64)anim_count * anim_loops) {
+        WRITE_ONCE(anim_playing, false);    /* the next tick stops the timer */
+        put_fb = anim_release();
+        goto out;
+    }
+    if (idx < anim_shown)
+        goto out;               /* early kick, this frame is already up */
+    if (anim_shown)
+        oled_stats.dropped += idx - anim_shown;
+    anim_shown = idx + 1;
+
+    div_u64_rem(idx, anim_count, &frame);
+    if (!oled_present(&anim_frames[frame * OLED_FB_SIZE]))
+        oled_stats.frames++;
+    /* Each frame is due before the next one's slot starts */
+    deadline = ktime_add_ns(anim_start, (idx + 1) * anim_period_ns);
+    if (!anim_sequential && ktime_after(ktime_get(), deadline))
+        oled_stats.late++;
+out:
+    mutex_unlock(&oled_lock);
+    if (put_fb)
+        etx_oled_put();
+}
+
+static void anim_stop(void)
+{
+    bool had_fb;
+
+    mutex_lock(&oled_lock);
+    anim_playing = false;
+    mutex_unlock(&oled_lock);
+
+    hrtimer_cancel(&anim_timer);
+    cancel_work_sync(&anim_work);
+
+    mutex_lock(&oled_lock);
+    had_fb = anim_release();
+    mutex_unlock(&oled_lock);
+
+    if (had_fb)
+        etx_oled_put();
+}
+
+/*
+ * Install @count frames given in the current orientation, stored in
+ * panel layout. Takes ownership of @frames.
+ */
+static int anim_install(u8 *frames, unsigned int count)
+{
+    u8 *tmp;
+    unsigned int i;
+
+    anim_stop();
+
+    mutex_lock(&oled_lock);
+    if (oled_transposed()) {
+        tmp = kmalloc(OLED_FB_SIZE, GFP_KERNEL);
+        if (!tmp) {
+            mutex_unlock(&oled_lock);
+            kvfree(frames);
+            return -ENOMEM;
+        }
+        for (i = 0; i < count; i++) {
+            memcpy(tmp, &frames[i * OLED_FB_SIZE], OLED_FB_SIZE);
+            oled_transpose_frame(tmp, &frames[i * OLED_FB_SIZE], true);
+        }
+        kfree(tmp);
+    }
+    kvfree(anim_frames);
+    anim_frames = frames;
+    anim_count  = count;
+    mutex_unlock(&oled_lock);
+    return 0;
+}
+
+int etx_oled_anim_upload(const void __user *user_frames, u32 count)
+{
+    size_t size;
+    u8 *frames;
+
+    if (!count || count > OLED_ANIM_MAX_FRAMES)
+        return -EINVAL;
+
+    size = (size_t)count * OLED_FB_SIZE;
+    frames = kvmalloc(size, GFP_KERNEL);
+    if (!frames)
+        return -ENOMEM;
+    if (copy_from_user(frames, user_frames, size)) {
+        kvfree(frames);
+        return -EFAULT;
+    }
+    return anim_install(frames, count);
+}
+EXPORT_SYMBOL_GPL(etx_oled_anim_upload);
+
+static int anim_begin(u64 period_ns, unsigned int loops, bool sequential)
+{
+    bool had_fb;
+    int ret;
+
+    anim_stop();
+
+    /* Playback draws into the framebuffers, keep them while it runs */
+    ret = etx_oled_get();
+    if (ret)
+        return ret;
+
+    mutex_lock(&oled_lock);
+    if (!anim_frames || oled_console_on) {
+        mutex_unlock(&oled_lock);
+        etx_oled_put();
+        return oled_console_on ? -EBUSY : -ENODATA;
+    }
+    had_fb          = anim_has_fb;
+    anim_has_fb     = true;
+    anim_period_ns  = period_ns;
+    anim_loops      = loops;
+    anim_sequential = sequential;
+    anim_pos        = 0;
+    anim_shown      = 0;
+    anim_start      = ktime_get();
+    anim_playing    = true;
+    mutex_unlock(&oled_lock);
+
+    if (had_fb)
+        etx_oled_put();         /* a racing start's reference */
+
+    queue_work(system_highpri_wq, &anim_work);
+    hrtimer_start(&anim_timer, ns_to_ktime(anim_period_ns), HRTIMER_MODE_REL);
+    return 0;
+}
+
+/* Periods shorter than a full frame transfer are raised to one */
+int etx_oled_anim_play(u32 period_us, u32 loops)
+{
+    if (!period_us)
+        return -EINVAL;
+    period_us = max_t(u32, period_us, OLED_ANIM_MIN_US);
+    return anim_begin((u64)period_us * NSEC_PER_USEC, loops, false);
+}
+EXPORT_SYMBOL_GPL(etx_oled_anim_play);
+
+void etx_oled_anim_stop(void)
+{
+    anim_stop();
+}
+EXPORT_SYMBOL_GPL(etx_oled_anim_stop);
+
+/*
+ * Subframes are threshold planes: level >= 1 is hi|lo, >= 2 is hi,
+ * >= 3 is hi&lo. oled_present() then only sends the spans where
+ * consecutive subframes differ, i.e. where mid-gray pixels are.
+ */
+int etx_oled_gray_set(const void __user *user_planes, u32 levels, u32 period_us)
+{
+    unsigned int count, i;
+    u8 *planes, *frames;
+    const u8 *lo, *hi;
+    int ret;
+
+    if (levels < 2 || levels > 4 || !period_us)
+        return -EINVAL;
+
+    planes = kmalloc(2 * OLED_FB_SIZE, GFP_KERNEL);
+    if (!planes)
+        return -ENOMEM;
+    if (copy_from_user(planes, user_planes, 2 * OLED_FB_SIZE)) {
+        kfree(planes);
+        return -EFAULT;
+    }
+
+    count  = levels - 1;
+    frames = kvmalloc(count * OLED_FB_SIZE, GFP_KERNEL);
+    if (!frames) {
+        kfree(planes);
+        return -ENOMEM;
+    }
+    lo = planes;
+    hi = planes + OLED_FB_SIZE;
+    for (i = 0; i < OLED_FB_SIZE; i++) {
+        frames[i] = hi[i] | lo[i];
+        if (count > 1)
+            frames[OLED_FB_SIZE + i] = hi[i];
+        if (count > 2)
+            frames[2 * OLED_FB_SIZE + i] = hi[i] & lo[i];
+    }
+    kfree(planes);
+
+    ret = anim_install(frames, count);
+    if (ret)
+        return ret;
+    period_us = max_t(u32, period_us, OLED_GRAY_MIN_US);
+    return anim_begin((u64)period_us * NSEC_PER_USEC, 0, true);
+}
+EXPORT_SYMBOL_GPL(etx_oled_gray_set);
+
+static void anim_init(void)
+{
+    hrtimer_init(&anim_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    anim_timer.function = anim_tick;
+}
+
+static void anim_exit(void)
+{
+    anim_stop();
+    kvfree(anim_frames);
+    anim_frames = NULL;
+}
+#else
+static inline void anim_init(void) {}
+static inline void anim_exit(void) {}
+#endif /* ETX_ANIM */
+
+int etx_oled_fill(u8 pattern)
+{
+    int ret;
+
+    mutex_lock(&oled_lock);
+    ret = oled_can_draw();
+    if (ret) {
+        mutex_unlock(&oled_lock);
+        return ret;
+    }
+    memset(oled_fb, pattern, OLED_FB_SIZE);
+    if (oled_transposed())
+        memset(oled_lfb, pattern, OLED_FB_SIZE);
+    ret = oled_flush_range(0, OLED_FB_SIZE);
+    if (!ret && oled_powered)
+        oled_fb_stale = false;
+    mutex_unlock(&oled_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(etx_oled_fill);
+
+/*
+ * User frame bytes [start, start + len) from @buf, diffed against the
+ * shadow buffer; only changes are flushed. The range must lie within
+ * the frame.
+ */
+int etx_oled_write(const u8 __user *buf, unsigned int start, size_t len)
+{
+    return etx_oled_write_by(buf, start, len, 0);
+}
+EXPORT_SYMBOL_GPL(etx_oled_write);
+
+/*
+ * As etx_oled_write(), but the frame is dropped with -ETIME if the
+ * panel is still busy with earlier work at @deadline (CLOCK_MONOTONIC,
+ * 0 = none). A frame already being sent is never cut short.
+ */
+int etx_oled_write_by(const u8 __user *buf, unsigned int start, size_t len, ktime_t deadline)
+{
+    int ret;
+
+    if (!len || start + len > OLED_FB_SIZE)
+        return -EINVAL;
+
+    mutex_lock(&oled_lock);
+    ret = oled_can_draw();
+    if (ret) {
+        mutex_unlock(&oled_lock);
+        return ret;
+    }
+    if (deadline && ktime_after(ktime_get(), deadline)) {
+        oled_stats.dropped++;
+        mutex_unlock(&oled_lock);
+        return -ETIME;
+    }
+    memcpy(oled_stage, oled_fb, OLED_FB_SIZE);
+    if (copy_from_user((oled_transposed() ? oled_lfb : oled_stage) + start, buf, len)) {
+        mutex_unlock(&oled_lock);
+        return -EFAULT;
+    }
+    ret = oled_commit(start, start + len);
+    if (!ret) {
+        oled_stats.frames++;
+        if (deadline && ktime_after(ktime_get(), deadline))
+            oled_stats.late++;
+    }
+    mutex_unlock(&oled_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(etx_oled_write_by);
+
+void etx_oled_get_stats(struct etx_oled_stats *st)
+{
+    mutex_lock(&oled_lock);
+    *st = oled_stats;
+    mutex_unlock(&oled_lock);
+}
+EXPORT_SYMBOL_GPL(etx_oled_get_stats);
+
+/* Reset pulse, init and frame replay on a powered panel */
+int etx_oled_reset(void)
+{
+    int ret = -EIO;
+
+    mutex_lock(&oled_lock);
+    if (oled_powered) {
+        bus_flush_begin();
+        ret = oled_recover();
+        bus_flush_end();
+    }
+    mutex_unlock(&oled_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(etx_oled_reset);
+
+/* Detach from the panel; power it off first */
+void etx_oled_detach(void)
+{
+    con_stop();
+#if ETX_ANIM
+    anim_stop();
+#endif
+
+    spin_lock(&bus_lock);
+    bus_adap = NULL;
+    spin_unlock(&bus_lock);
+
+    mutex_lock(&oled_lock);
+    oled_client = NULL;
+    oled_reset  = NULL;
+    oled_vdd    = NULL;
+    oled_vbat   = NULL;
+    mutex_unlock(&oled_lock);
+}
+EXPORT_SYMBOL_GPL(etx_oled_detach);
+
+/* ===================== AHT20 ===================== */
+
+/* Load the calibration coefficients (0xBE), then let the sensor settle */
+int etx_aht20_init(struct i2c_client *client)
+{
+    u8 cmd[3] = {0xBE, 0x08, 0x00};
+    struct i2c_msg msg = { .addr = client->addr, .len = 3, .buf = cmd };
+    int ret;
+
+    ret = etx_bus_xfer_aht20(client->adapter, &msg);
+    if (ret)
+        return ret;
+    msleep(40);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(etx_aht20_init);
+
+int etx_aht20_trigger(struct i2c_client *client)
+{
+    u8 cmd[3] = {0xAC, 0x33, 0x00};
+    struct i2c_msg msg = { .addr = client->addr, .len = 3, .buf = cmd };
+
+    return etx_bus_xfer_aht20(client->adapter, &msg);
+}
+EXPORT_SYMBOL_GPL(etx_aht20_trigger);
+
+/* Read and convert a finished conversion, x10 °C and x10 % */
+int etx_aht20_fetch(struct i2c_client *client, int *temperature, int *humidity)
+{
+    u8 d[6];
+    struct i2c_msg msg = { .addr = client->addr, .flags = I2C_M_RD,
+                           .len = 6, .buf = d };
+    u32 rt, rh;
+    int ret;
+
+    ret = etx_bus_xfer_aht20(client->adapter, &msg);
+    if (ret < 0)
+        return ret;
+
+    rh = ((d[1] << 12) | (d[2] << 4) | (d[3] >> 4));
+    rt = (((d[3] & 0x0F) << 16) | (d[4] << 8) | d[5]);
+
+    *humidity    = (rh * 1000) / 1048576;
+    *temperature = ((rt * 2000) / 1048576) - 500;
+    return 0;
+}
+EXPORT_SYMBOL_GPL(etx_aht20_fetch);
+
+int etx_aht20_measure(struct i2c_client *client, int *temperature, int *humidity)
+{
+    int ret;
+
+    ret = etx_aht20_trigger(client);
+    if (ret < 0)
+        return ret;
+    msleep(AHT20_CONV_MS);
+    return etx_aht20_fetch(client, temperature, humidity);
+}
+EXPORT_SYMBOL_GPL(etx_aht20_measure);
+
+/*
+ * Status byte (AHT20_STATUS_*) from a bare 1-byte read. No command is
+ * sent, so this never starts a conversion and is safe while one runs.
+ */
+int etx_aht20_status(struct i2c_client *client)
+{
+    u8 st;
+    struct i2c_msg msg = { .addr = client->addr, .flags = I2C_M_RD,
+                           .len = 1, .buf = &st };
+    int ret;
+
+    ret = etx_bus_xfer_aht20(client->adapter, &msg);
+    if (ret < 0)
+        return ret;
+    return st;
+}
+EXPORT_SYMBOL_GPL(etx_aht20_status);
+
+/* ===================== SAMPLER ===================== */
+
+static struct task_struct *sampler_task;
+static void (*sampler_round)(void);
+static DEFINE_MUTEX(sampler_lock);       /* start, stop and period changes */
+static unsigned int sampler_period_ms;   /* effective period, 0 = idle */
+static unsigned int sampler_req_ms;      /* fastest front-end request */
+static bool sampler_rearm;               /* kthread: period changed */
+
+static void sampler_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(sampler_work, sampler_work_fn);
+static ktime_t sampler_next;
+
+/* Clock the trigger deadlines are expressed in */
+static clockid_t sampler_clockid(void)
+{
+    switch (sample_align) {
+    case SAMPLE_ALIGN_REAL:
+        return CLOCK_REALTIME;
+    case SAMPLE_ALIGN_TAI:
+        return CLOCK_TAI;
+    default:
+        return CLOCK_MONOTONIC;
+    }
+}
+
+static ktime_t sampler_now(void)
+{
+    switch (sample_align) {
+    case SAMPLE_ALIGN_REAL:
+        return ktime_get_real();
+    case SAMPLE_ALIGN_TAI:
+        return ktime_get_clocktai();
+    default:
+        return ktime_get();
+    }
+}
+
+/*
+ * Next trigger deadline after @prev. Aligned mode picks the next
+ * period boundary (plus offset) of the wall clock so every host fires
+ * together; otherwise the period is simply added. Missed slots are
+ * skipped rather than replayed.
+ */
+static ktime_t sampler_advance(ktime_t prev, unsigned int period_ms)
+{
+    s64 period = (s64)period_ms * NSEC_PER_MSEC;
+    s64 offset = (s64)(sample_offset_ms % period_ms) * NSEC_PER_MSEC;
+    ktime_t now = sampler_now();
+    ktime_t next;
+
+    if (sample_align == SAMPLE_ALIGN_NONE) {
+        next = ktime_add_ns(prev, period);
+        if (ktime_before(next, now))
+            next = ktime_add_ns(now, period);
+        return next;
+    }
+
+    next = ns_to_ktime((div64_s64(ktime_to_ns(now) - offset, period) + 1) * period
+                       + offset);
+    /* A jiffy-rounded wakeup may land just before the boundary it targeted */
+    if (!ktime_after(next, prev))
+        next = ktime_add_ns(next, period);
+    return next;
+}
+
+/*
+ * Jiffies until @next, rounded up: nsecs_to_jiffies() truncates and the
+ * current jiffy is already partly gone, so one more keeps delayed work
+ * from firing before the boundary it targets.
+ */
+static unsigned long sampler_delay(ktime_t next)
+{
+    s64 delay_ns = ktime_to_ns(ktime_sub(next, sampler_now()));
+
+    return delay_ns > 0 ? nsecs_to_jiffies(delay_ns) + 1 : 0;
+}
+
+static ktime_t sampler_first(unsigned int period_ms)
+{
+    return sample_align ? sampler_advance(0, period_ms) : sampler_now();
+}
+
+static void sampler_work_fn(struct work_struct *work)
+{
+    unsigned int period_ms = READ_ONCE(sampler_period_ms);
+
+    /* Going idle: sampler_apply() is cancelling us */
+    if (!period_ms)
+        return;
+
+    sampler_round();
+
+    sampler_next = sampler_advance(sampler_next, period_ms);
+    schedule_delayed_work(&sampler_work, sampler_delay(sampler_next));
+}
+
+static int sampler_thread_fn(void *unused)
+{
+    unsigned int period_ms = 0;
+    ktime_t next = 0;
+
+    while (!kthread_should_stop()) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (kthread_should_stop()) {
+            __set_current_state(TASK_RUNNING);
+            break;
+        }
+        if (READ_ONCE(sampler_rearm)) {
+            __set_current_state(TASK_RUNNING);
+            WRITE_ONCE(sampler_rearm, false);
+            period_ms = READ_ONCE(sampler_period_ms);
+            if (period_ms)
+                next = sampler_first(period_ms);
+            continue;
+        }
+        if (!period_ms) {
+            schedule();         /* idle until the period changes */
+            continue;
+        }
+        if (schedule_hrtimeout_range_clock(&next, 0, HRTIMER_MODE_ABS,
+                                           sampler_clockid()))
+            continue;   /* woken early, e.g. by kthread_stop() */
+
+        sampler_round();
+        next = sampler_advance(next, period_ms);
+    }
+    return 0;
+}
+
+/*
+ * Run at the faster of sample_period_ms and the front-end's request,
+ * or idle if both are 0. Caller holds sampler_lock.
+ */
+static void sampler_apply(void)
+{
+    unsigned int period_ms = sample_period_ms;
+
+    if (sampler_req_ms && (!period_ms || sampler_req_ms < period_ms))
+        period_ms = sampler_req_ms;
+    if (!sampler_round || period_ms == sampler_period_ms)
+        return;
+    WRITE_ONCE(sampler_period_ms, period_ms);
+
+    if (sampler_task) {
+        WRITE_ONCE(sampler_rearm, true);
+        wake_up_process(sampler_task);
+        return;
+    }
+    cancel_delayed_work_sync(&sampler_work);
+    if (!period_ms)
+        return;
+    sampler_next = sampler_first(period_ms);
+    schedule_delayed_work(&sampler_work, sampler_delay(sampler_next));
+}
+
+static int sampler_create_thread(void)
+{
+    struct task_struct *t;
+    int ret;
+
+    t = kthread_create(sampler_thread_fn, NULL, "etx_aht20");
+    if (IS_ERR(t))
+        return PTR_ERR(t);
+
+    if (sampler_cpu >= 0) {
+        /* Bound to an offline CPU the thread would silently run elsewhere */
+        if (sampler_cpu >= nr_cpu_ids || !cpu_online(sampler_cpu)) {
+            pr_err("AHT20: sampler_cpu %d is not online\n", sampler_cpu);
+            kthread_stop(t);
+            return -EINVAL;
+        }
+        kthread_bind(t, sampler_cpu);
+    }
+
+    if (sampler_prio) {
+        struct sched_attr attr = {
+            .size           = sizeof(attr),
+            .sched_policy   = SCHED_FIFO,
+            .sched_priority = sampler_prio,
+        };
+
+        ret = sched_setattr_nocheck(t, &attr);
+        if (ret) {
+            pr_err("AHT20: cannot set SCHED_FIFO %u (%d)\n", sampler_prio, ret);
+            kthread_stop(t);
+            return ret;
+        }
+    }
+
+    sampler_task = t;
+    wake_up_process(t);
+    return 0;
+}
+
+int etx_sampler_start(void (*round)(void))
+{
+    int ret = 0;
+
+    if (sample_align > SAMPLE_ALIGN_TAI) {
+        pr_err("AHT20: invalid sample_align %u\n", sample_align);
+        return -EINVAL;
+    }
+
+    mutex_lock(&sampler_lock);
+    if (sampler_round) {
+        ret = -EBUSY;
+        goto out;
+    }
+    if (sampler_kthread) {
+        ret = sampler_create_thread();
+        if (ret)
+            goto out;
+    }
+    sampler_round = round;
+    sampler_apply();
+out:
+    mutex_unlock(&sampler_lock);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(etx_sampler_start);
+
+void etx_sampler_stop(void)
+{
+    mutex_lock(&sampler_lock);
+    if (sampler_task) {
+        kthread_stop(sampler_task);
+        sampler_task = NULL;
+    }
+    WRITE_ONCE(sampler_period_ms, 0);
+    cancel_delayed_work_sync(&sampler_work);
+    sampler_round  = NULL;
+    sampler_req_ms = 0;
+    mutex_unlock(&sampler_lock);
+}
+EXPORT_SYMBOL_GPL(etx_sampler_stop);
+
+/* Front-end rate request, e.g. the fastest subscriber; 0 withdraws it */
+void etx_sampler_request(unsigned int period_ms)
+{
+    mutex_lock(&sampler_lock);
+    sampler_req_ms = period_ms;
+    sampler_apply();
+    mutex_unlock(&sampler_lock);
+}
+EXPORT_SYMBOL_GPL(etx_sampler_request);
+
+unsigned int etx_sampler_period_ms(void)
+{
+    return READ_ONCE(sampler_period_ms);
+}
+EXPORT_SYMBOL_GPL(etx_sampler_period_ms);
+
+/* ===================== INIT / EXIT ===================== */
+static int __init etx_core_init(void)
+{
+    etx_lazy_init(&oled_mem, sizeof(struct oled_bufs), oled_mem_attach);
+    anim_init();
+    return 0;
+}
+
+static void __exit etx_core_exit(void)
+{
+    etx_sampler_stop();
+    anim_exit();
+    etx_lazy_exit(&oled_mem);
+}
+
+module_init(etx_core_init);
+module_exit(etx_core_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Murugesan");
+MODULE_DESCRIPTION("Shared SSD1306 + AHT20 core for the ETX I2C drivers");
+MODULE_VERSION("2.0");
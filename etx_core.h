@@ -0,0 +1,132 @@
+/***************************************************************************//**
+*  \file       etx_core.h
+*
+*  \details    Shared SSD1306 + AHT20 core used by both driver variants:
+*              bus transport, OLED framebuffer engine, AHT20 access and
+*              the periodic sampler. Lives in etx_core.ko.
+*
+*******************************************************************************/
+#ifndef ETX_CORE_H
+#define ETX_CORE_H
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/i2c.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+
+/* ===================== BUILD OPTIONS ===================== */
+#ifndef ETX_ANIM
+#define ETX_ANIM            1      /* animation and grayscale playback */
+#endif
+#ifndef ETX_ROTATE
+#define ETX_ROTATE          1      /* 90/270 rotation (0/180/mirror are free) */
+#endif
+#ifndef ETX_CONSOLE
+#define ETX_CONSOLE         1      /* kernel log console on the OLED */
+#endif
+
+/* ===================== CONFIG ===================== */
+#define OLED_WIDTH          128
+#define OLED_PAGES          8
+#define OLED_FB_SIZE        (OLED_WIDTH * OLED_PAGES)
+
+#define AHT20_CONV_MS       80     /* datasheet measurement time */
+#define AHT20_STATUS_BUSY   0x80   /* conversion in progress */
+#define AHT20_STATUS_CAL    0x08   /* calibration loaded */
+
+/*
+ * Orientation. 0/180 and the mirrors only change the segment/COM remap,
+ * so they cost nothing per frame. 90/270 make the frame 64 wide and
+ * 128 tall (same 1 KiB page layout) and transpose it into the panel.
+ */
+#define OLED_ROTATE_0       0
+#define OLED_ROTATE_90      1
+#define OLED_ROTATE_180     2
+#define OLED_ROTATE_270     3
+
+#define OLED_MIRROR_X       0x1   /* flip left/right */
+#define OLED_MIRROR_Y       0x2   /* flip top/bottom */
+
+#define OLED_ANIM_MAX_FRAMES 256
+
+/* Frame accounting; a frame with a deadline that passes before it is sent is dropped */
+struct etx_oled_stats {
+    u64 frames;          /* frames sent */
+    u64 dropped;         /* stale writes and skipped animation frames */
+    u64 late;            /* sent, but finished past their deadline */
+};
+
+/* ===================== LAZY BUFFERS ===================== */
+/*
+ * Zeroed buffer allocated by the first etx_lazy_get() and freed once
+ * the last user has been gone for etx_core.lazy_grace_ms. @attach swaps
+ * the owner's live pointer (to the buffer, or to NULL before the free)
+ * under whatever lock the owner's readers use.
+ */
+struct etx_lazy {
+    struct mutex        lock;
+    unsigned int        users;
+    size_t              size;
+    void               *buf;
+    struct delayed_work release;
+    void              (*attach)(struct etx_lazy *l, void *buf);
+};
+
+void   etx_lazy_init(struct etx_lazy *l, size_t size,
+                     void (*attach)(struct etx_lazy *l, void *buf));
+int    etx_lazy_get(struct etx_lazy *l);
+void   etx_lazy_put(struct etx_lazy *l);
+void   etx_lazy_exit(struct etx_lazy *l);
+size_t etx_lazy_bytes(struct etx_lazy *l);
+
+/* ===================== TRANSPORT ===================== */
+int etx_bus_xfer_aht20(struct i2c_adapter *adap, struct i2c_msg *msg);
+
+/* ===================== SSD1306 ===================== */
+/*
+ * One panel per system; all calls take the panel lock themselves.
+ * Drawing needs the framebuffers: hold etx_oled_get() while using them.
+ */
+void etx_oled_board_add(int bus, unsigned short addr);
+void etx_oled_board_remove(void);
+int  etx_oled_attach(struct i2c_client *client);
+void etx_oled_detach(void);
+int  etx_oled_power_on(void);
+void etx_oled_power_off(void);
+unsigned int etx_oled_powerup_us(void);
+int  etx_oled_get(void);
+void etx_oled_put(void);
+size_t etx_oled_buffer_bytes(void);
+int  etx_oled_fill(u8 pattern);
+int  etx_oled_write(const u8 __user *buf, unsigned int start, size_t len);
+int  etx_oled_write_by(const u8 __user *buf, unsigned int start, size_t len, ktime_t deadline);
+void etx_oled_get_stats(struct etx_oled_stats *st);
+int  etx_oled_reset(void);
+int  etx_oled_set_orientation(u32 rotation, u32 mirror);
+#if ETX_ANIM
+int  etx_oled_anim_upload(const void __user *frames, u32 count);
+int  etx_oled_anim_play(u32 period_us, u32 loops);
+void etx_oled_anim_stop(void);
+int  etx_oled_gray_set(const void __user *planes, u32 levels, u32 period_us);
+#endif
+
+/* ===================== AHT20 ===================== */
+/* Callers serialise conversions on one sensor */
+int etx_aht20_init(struct i2c_client *client);
+int etx_aht20_trigger(struct i2c_client *client);
+int etx_aht20_fetch(struct i2c_client *client, int *temperature, int *humidity);
+int etx_aht20_measure(struct i2c_client *client, int *temperature, int *humidity);
+int etx_aht20_status(struct i2c_client *client);
+
+/* ===================== SAMPLER ===================== */
+/*
+ * Calls @round every sample_period_ms (etx_core parameter), or faster
+ * if the front-end requests it; idle while both are 0.
+ */
+int  etx_sampler_start(void (*round)(void));
+void etx_sampler_stop(void);
+void etx_sampler_request(unsigned int period_ms);
+unsigned int etx_sampler_period_ms(void);
+
+#endif /* ETX_CORE_H */
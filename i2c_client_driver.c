@@ -13,7 +13,34 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/uaccess.h>
-#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "etx_core.h"
+
+/* ===================== BUILD OPTIONS ===================== */
+/*
+ * Optional subsystems, all built unless the Makefile passes -DETX_X=0
+ * (make ETX_HISTORY=n ...). The sampler, sample cache and batched OLED
+ * flush are always built. ETX_ANIM and ETX_ROTATE live in etx_core.h.
+ */
+#ifndef ETX_HISTORY
+#define ETX_HISTORY         1      /* etx_aht20_hist compressed export */
+#endif
+#ifndef ETX_ZONES
+#define ETX_ZONES           1      /* per-zone aggregate channels */
+#endif
+#ifndef ETX_TIMING
+#define ETX_TIMING          1      /* debugfs boot phase timing */
+#endif
 
 /* ===================== CONFIG ===================== */
 #define I2C_BUS_AVAILABLE   1
@@ -23,139 +50,1599 @@
 
 #define OLED_DEV_NAME       "etx_oled"
 #define AHT20_DEV_NAME      "etx_aht20"
+#define HIST_DEV_NAME       "etx_aht20_hist"
+
+#define AHT20_RING_LEN      64     /* samples kept for read() consumers */
+#define AHT20_MAX_SENSORS   8
+#define AHT20_MAX_ZONES     8
+#define AHT20_MINORS        (AHT20_MAX_SENSORS + AHT20_MAX_ZONES)
+
+/* ===================== PUBLISH PARAMS ===================== */
+/* Deadband publishing: all zero = publish every sample. Sampler timing is in etx_core. */
+static unsigned int deadband_temp;
+module_param(deadband_temp, uint, 0644);
+MODULE_PARM_DESC(deadband_temp, "Publish only when temperature moves more than this (x10 °C)");
+
+static unsigned int deadband_hum;
+module_param(deadband_hum, uint, 0644);
+MODULE_PARM_DESC(deadband_hum, "Publish only when humidity moves more than this (x10 %)");
+
+static unsigned int deadband_max_age_ms;
+module_param(deadband_max_age_ms, uint, 0644);
+MODULE_PARM_DESC(deadband_max_age_ms, "Publish anyway once the last published sample is this old (0 = never)");
+
+/* ===================== SENSOR PARAMS ===================== */
+static int aht20_bus[AHT20_MAX_SENSORS] = { I2C_BUS_AVAILABLE };
+static int aht20_nbus = 1;
+module_param_array(aht20_bus, int, &aht20_nbus, 0444);
+MODULE_PARM_DESC(aht20_bus, "I2C bus of each AHT20 instance (default: one on bus 1)");
+
+static unsigned int aht20_zone[AHT20_MAX_SENSORS];
+static int aht20_nzone;
+module_param_array(aht20_zone, uint, &aht20_nzone, 0444);
+MODULE_PARM_DESC(aht20_zone, "Zone of each AHT20 instance, in aht20_bus order (default 0)");
+
+/*
+ * With a cap, conversions on one sensor are at least
+ * AHT20_CONV_MS * 100 / max_duty_pct apart (800 ms at 10%): reads and
+ * etx_core.sample_period_ms rounds that come sooner get the cached
+ * sample, or -EAGAIN when there is none yet.
+ */
+static unsigned int max_duty_pct;
+module_param(max_duty_pct, uint, 0644);
+MODULE_PARM_DESC(max_duty_pct, "Cap on conversion time per sensor against self-heating, percent (0 = none, default); faster reads and sampler rounds reuse the last sample");
+
+/* ===================== HISTORY PARAMS ===================== */
+#if ETX_HISTORY
+static unsigned int history_len = 86400;
+module_param(history_len, uint, 0444);
+MODULE_PARM_DESC(history_len, "AHT20 samples kept for history export (0 = off, default one day at 1 Hz)");
+#endif
 
 /* ===================== GLOBALS ===================== */
 static struct i2c_adapter *i2c_adap;
 static struct i2c_client  *oled_client;
-static struct i2c_client  *aht20_client;
 
 /* Char devices */
 static dev_t oled_dev, aht20_dev;
 static struct cdev oled_cdev, aht20_cdev;
+#if ETX_HISTORY
+static dev_t hist_dev;
+static struct cdev hist_cdev;
+#endif
 
 /* ===================== IOCTL ===================== */
 #define OLED_CLEAR      _IO('o',1)
 #define OLED_FILL       _IO('o',2)
+#define OLED_RESET      _IO('o',3)   /* reset pulse + init + frame replay */
+#define OLED_POWER_OFF  _IO('o',4)
+#define OLED_POWER_ON   _IO('o',5)
+
+/* Orientation: OLED_ROTATE_* and OLED_MIRROR_* from etx_core.h */
+struct oled_orientation {
+    __u32 rotation;      /* OLED_ROTATE_* */
+    __u32 mirror;        /* OLED_MIRROR_* */
+};
+
+#define OLED_SET_ORIENTATION _IOW('o',6, struct oled_orientation)
+
+/* Animation: upload up to OLED_ANIM_MAX_FRAMES once, then play them from the kernel */
+struct oled_anim {
+    __u64 frames;        /* user pointer to count * 1024 bytes */
+    __u32 count;
+    __u32 reserved;
+};
+
+struct oled_anim_play {
+    __u32 period_us;     /* time per frame, at least 25 ms */
+    __u32 loops;         /* 0 = until OLED_ANIM_STOP */
+};
+
+#define OLED_ANIM_UPLOAD    _IOW('o',7, struct oled_anim)
+#define OLED_ANIM_PLAY      _IOW('o',8, struct oled_anim_play)
+#define OLED_ANIM_STOP      _IO('o',9)
+
+/*
+ * Grayscale by temporal dithering. A pixel's level is 2*hi + lo from two
+ * bitplanes; levels-1 subframes are cycled, subframe k lighting pixels
+ * with level >= k. OLED_ANIM_STOP ends it.
+ */
+struct oled_gray {
+    __u64 planes;        /* user pointer: lo plane then hi plane, 1024 bytes each */
+    __u32 levels;        /* 2..4 */
+    __u32 period_us;     /* time each subframe is shown, at least 2 ms */
+};
+
+#define OLED_GRAY_SET       _IOW('o',10, struct oled_gray)
+
+/*
+ * Frame budget for this file's write()s, in us from the call (0 = none).
+ * A frame that cannot start within it is dropped and write() fails
+ * with ETIME; the next frame supersedes it anyway.
+ */
+#define OLED_SET_DEADLINE   _IOW('o',11, __u32)
 
 struct aht20_data {
     int temperature;   /* x10 °C */
     int humidity;      /* x10 %  */
 };
 
+/* Record returned by read() on the AHT20 device */
+struct aht20_sample {
+    __u64 timestamp_ns;  /* CLOCK_REALTIME at trigger */
+    __u32 seq;
+    __s32 temperature;   /* x10 °C */
+    __s32 humidity;      /* x10 %  */
+    __u32 reserved;
+};
+
+/*
+ * Aggregate over the sensors of one zone from the last sampling round.
+ * Set .zone, the rest is filled in. The zone's mean is also published
+ * as a sample stream on etx_aht20 minor AHT20_MAX_SENSORS + zone.
+ */
+struct aht20_zone_stats {
+    __u32 zone;
+    __u32 sensors;       /* sensors that contributed */
+    __u64 timestamp_ns;
+    __s32 temp_min, temp_max, temp_mean, temp_spread;
+    __s32 hum_min, hum_max, hum_mean, hum_spread;
+};
+
 #define AHT20_READ_DATA _IOR('a',1, struct aht20_data)
+#define AHT20_READ_ZONE _IOWR('a',2, struct aht20_zone_stats)
 
-/* ===================== SSD1306 ===================== */
+/*
+ * Per-reader rate: read() then returns at most one sample per period_ms.
+ * The sensors are sampled at the fastest rate any reader asks for and
+ * not at all while nobody subscribes (unless etx_core.sample_period_ms
+ * is set). 0 unsubscribes.
+ */
+#define AHT20_SUBSCRIBE _IOW('a',3, __u32)
 
-static void oled_write(u8 mode, u8 data)
-{
-    u8 buf[2] = {mode, data};
-    i2c_master_send(oled_client, buf, 2);
-}
+/*
+ * Bounded-staleness read: the sensor's last conversion if it is at most
+ * max_age_ms old, otherwise a new one. If the duty cycle cap forbids
+ * converting yet, the last one is returned anyway; check age_ms.
+ */
+struct aht20_fresh {
+    __u32 max_age_ms;    /* in */
+    __u32 age_ms;        /* out: age of the returned reading */
+    __u64 timestamp_ns;  /* out: CLOCK_REALTIME at trigger */
+    __s32 temperature;   /* out: x10 °C */
+    __s32 humidity;      /* out: x10 %  */
+};
 
-static void oled_init(void)
-{
-    msleep(100);
-    oled_write(0x00, 0xAE);
-    oled_write(0x00, 0xA8);
-    oled_write(0x00, 0x3F);
-    oled_write(0x00, 0xAF);
-}
+#define AHT20_READ_FRESH _IOWR('a',4, struct aht20_fresh)
+
+/*
+ * Two-phase read on a sensor minor. AHT20_TRIGGER starts a conversion
+ * in the background and returns its ticket; triggers arriving before
+ * it starts share it. poll() reports EPOLLPRI once this file's last
+ * ticket is done, and AHT20_COLLECT returns the reading (blocking
+ * unless O_NONBLOCK). Only the newest result is kept, so a superseded
+ * ticket collects a newer reading.
+ */
+struct aht20_ticket {
+    __u64 ticket;        /* in */
+    __u64 timestamp_ns;  /* out: CLOCK_REALTIME at trigger */
+    __s32 temperature;   /* out: x10 °C */
+    __s32 humidity;      /* out: x10 %  */
+};
+
+#define AHT20_TRIGGER   _IOR('a',5, __u64)
+#define AHT20_COLLECT   _IOWR('a',6, struct aht20_ticket)
+
+/*
+ * Deadline-bounded read: a new conversion if one can finish within
+ * budget_us, otherwise the last reading flagged AHT20_READ_CACHED.
+ * Both that and AHT20_READ_LATE count as deadline misses.
+ */
+struct aht20_deadline {
+    __u32 budget_us;     /* in */
+    __u32 flags;         /* out: AHT20_READ_* */
+    __u64 timestamp_ns;  /* out: CLOCK_REALTIME at trigger */
+    __s32 temperature;   /* out: x10 °C */
+    __s32 humidity;      /* out: x10 %  */
+};
+
+#define AHT20_READ_CACHED   0x1   /* no conversion fitted: last reading */
+#define AHT20_READ_LATE     0x2   /* converted, but finished past the deadline */
+
+#define AHT20_READ_DEADLINE _IOWR('a',7, struct aht20_deadline)
+
+/*
+ * History export (read() on etx_aht20_hist): this header, then groups of
+ * LEB128 varints. Each group is a run length N followed by three zigzag
+ * deltas - timestamp delta-of-delta (ms), temperature delta and
+ * humidity delta (x10) - that apply to each of the next N records. All
+ * predecessors start at 0, so the first group carries absolute values.
+ */
+#define AHT20_HIST_MAGIC    0x5A544841   /* "AHTZ" */
+#define AHT20_HIST_VERSION  1
 
-static void oled_clear(void)
+/* Header fields are little-endian whatever the host */
+struct aht20_hist_hdr {
+    __le32 magic;
+    __le16 version;
+    __le16 reserved;
+    __le32 count;        /* records encoded */
+    __le32 bytes;        /* body length following the header */
+};
+
+/* ===================== OLED CHAR OPS ===================== */
+static loff_t oled_llseek(struct file *f, loff_t off, int whence)
 {
-    int i;
-    for (i = 0; i < 1024; i++)
-        oled_write(0x40, 0x00);
+    return fixed_size_llseek(f, off, whence, OLED_FB_SIZE);
 }
 
-static void oled_fill(void)
+/* Per-open state */
+struct oled_file {
+    u32 deadline_us;                     /* OLED_SET_DEADLINE, 0 = none */
+};
+
+/* Frame data is diffed against the shadow buffer; only changes are flushed */
+static ssize_t oled_write_fb(struct file *f, const char __user *buf, size_t len, loff_t *off)
 {
-    int i;
-    for (i = 0; i < 1024; i++)
-        oled_write(0x40, 0xFF);
+    struct oled_file *of = f->private_data;
+    u32 budget_us = READ_ONCE(of->deadline_us);
+    ktime_t deadline = 0;
+    unsigned int start;
+    int ret;
+
+    if (budget_us)
+        deadline = ktime_add_us(ktime_get(), budget_us);
+
+    if (*off >= OLED_FB_SIZE)
+        return -ENOSPC;
+    start = *off;
+    len = min_t(size_t, len, OLED_FB_SIZE - start);
+    if (!len)
+        return 0;
+
+    ret = etx_oled_write_by(buf, start, len, deadline);
+    if (ret)
+        return ret;
+
+    *off += len;
+    return len;
 }
 
-/* OLED CHAR OPS */
 static long oled_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 {
+    struct oled_file *of = f->private_data;
+    struct oled_orientation o;
+    u32 budget_us;
+#if ETX_ANIM
+    struct oled_anim a;
+    struct oled_anim_play p;
+    struct oled_gray g;
+#endif
+
     switch (cmd) {
     case OLED_CLEAR:
-        oled_clear();
-        break;
+        return etx_oled_fill(0x00);
     case OLED_FILL:
-        oled_fill();
-        break;
+        return etx_oled_fill(0xFF);
+    case OLED_RESET:
+        return etx_oled_reset();
+    case OLED_POWER_OFF:
+        etx_oled_power_off();
+        return 0;
+    case OLED_POWER_ON:
+        return etx_oled_power_on();
+    case OLED_SET_ORIENTATION:
+        if (copy_from_user(&o, (void __user *)arg, sizeof(o)))
+            return -EFAULT;
+        return etx_oled_set_orientation(o.rotation, o.mirror);
+    case OLED_SET_DEADLINE:
+        if (get_user(budget_us, (u32 __user *)arg))
+            return -EFAULT;
+        WRITE_ONCE(of->deadline_us, budget_us);
+        return 0;
+#if ETX_ANIM
+    case OLED_ANIM_UPLOAD:
+        if (copy_from_user(&a, (void __user *)arg, sizeof(a)))
+            return -EFAULT;
+        return etx_oled_anim_upload(u64_to_user_ptr(a.frames), a.count);
+    case OLED_ANIM_PLAY:
+        if (copy_from_user(&p, (void __user *)arg, sizeof(p)))
+            return -EFAULT;
+        return etx_oled_anim_play(p.period_us, p.loops);
+    case OLED_ANIM_STOP:
+        etx_oled_anim_stop();
+        return 0;
+    case OLED_GRAY_SET:
+        if (copy_from_user(&g, (void __user *)arg, sizeof(g)))
+            return -EFAULT;
+        return etx_oled_gray_set(u64_to_user_ptr(g.planes), g.levels, g.period_us);
+#endif
     default:
         return -EINVAL;
     }
+}
+
+/* The framebuffers live while the device is open, plus the grace period */
+static int oled_open(struct inode *inode, struct file *f)
+{
+    struct oled_file *of;
+    int ret;
+
+    of = kzalloc(sizeof(*of), GFP_KERNEL);
+    if (!of)
+        return -ENOMEM;
+    ret = etx_oled_get();
+    if (ret) {
+        kfree(of);
+        return ret;
+    }
+    f->private_data = of;
+    return 0;
+}
+
+static int oled_release(struct inode *inode, struct file *f)
+{
+    etx_oled_put();
+    kfree(f->private_data);
     return 0;
 }
 
 static struct file_operations oled_fops = {
     .owner          = THIS_MODULE,
+    .open           = oled_open,
+    .release        = oled_release,
+    .llseek         = oled_llseek,
+    .write          = oled_write_fb,
     .unlocked_ioctl = oled_ioctl,
 };
 
 /* ===================== AHT20 ===================== */
 
-static int aht20_trigger(void)
+static DEFINE_MUTEX(aht20_lock);         /* one conversion (or round) at a time */
+
+/*
+ * A published sample stream; every sensor has one, and so does every zone.
+ * The ring only exists while the channel has readers.
+ */
+struct aht20_chan {
+    struct aht20_sample *ring;           /* AHT20_RING_LEN entries, or NULL */
+    struct etx_lazy      ring_mem;
+    struct aht20_sample  last;           /* last published, for the deadband */
+    u64                 seq;             /* samples published so far */
+    u64                 pub_mono_ns;     /* CLOCK_MONOTONIC of last publish */
+    spinlock_t          lock;
+    wait_queue_head_t   wq;
+};
+
+/* One conversion result, published or not */
+struct aht20_reading {
+    struct aht20_data data;
+    u64               ts;                /* CLOCK_REALTIME at trigger */
+    u64               mono_ns;           /* CLOCK_MONOTONIC at trigger */
+};
+
+struct hist_rec {
+    u64 ts_ms;           /* CLOCK_REALTIME at trigger */
+    s16 temperature;
+    s16 humidity;
+} __packed;
+
+struct aht20_sensor {
+    struct aht20_chan   chan;
+    struct i2c_adapter *adap;
+    struct i2c_client  *client;
+    unsigned int        zone;
+    u64                 conv_ns;         /* CLOCK_MONOTONIC of last conversion start */
+    unsigned int        duty_permille;   /* achieved duty cycle, smoothed */
+    struct aht20_reading cache;          /* last conversion */
+    bool                cache_valid;
+    struct work_struct  async_work;      /* AHT20_TRIGGER conversions */
+    u64                 async_req;       /* last ticket issued, under chan.lock */
+    u64                 async_started;   /* ticket being converted */
+    u64                 async_done;      /* last ticket finished */
+    struct aht20_reading async_rd;       /* its result */
+    int                 async_ret;
+    u64                 conv_busy_ns;    /* duration of the last conversion */
+    atomic_t            deadline_misses;
+#if ETX_HISTORY
+    struct hist_rec    *hist;            /* history ring, history_len entries */
+    struct etx_lazy     hist_mem;        /* allocated by the first sample */
+    bool                hist_held;
+    unsigned int        hist_head;       /* next slot to write */
+    unsigned int        hist_count;
+#endif
+};
+
+static struct aht20_sensor aht20_sensors[AHT20_MAX_SENSORS];
+static unsigned int aht20_nsensors;
+
+#if ETX_ZONES
+/* Virtual channel publishing the mean of a zone's sensors each round */
+struct aht20_zone {
+    struct aht20_chan       chan;
+    struct aht20_zone_stats stats;       /* last aggregate, under chan.lock */
+};
+
+static struct aht20_zone aht20_zones[AHT20_MAX_ZONES];
+#endif
+
+struct aht20_reader {
+    struct aht20_chan   *chan;
+    struct aht20_sensor *sensor;         /* NULL on zone channels */
+    u64                  next_seq;
+    u64                  ticket;         /* last AHT20_TRIGGER, 0 once collected */
+    unsigned int         period_ms;      /* subscription, 0 = every sample */
+    u64                  due_ns;         /* earliest timestamp to deliver */
+    struct list_head     sub;            /* on aht20_subs while subscribed */
+};
+
+static DEFINE_MUTEX(aht20_sub_lock);
+static LIST_HEAD(aht20_subs);
+
+static void aht20_ring_attach(struct etx_lazy *l, void *buf)
+{
+    struct aht20_chan *c = container_of(l, struct aht20_chan, ring_mem);
+    unsigned long flags;
+
+    spin_lock_irqsave(&c->lock, flags);
+    c->ring = buf;
+    spin_unlock_irqrestore(&c->lock, flags);
+}
+
+static void aht20_chan_init(struct aht20_chan *c)
+{
+    spin_lock_init(&c->lock);
+    init_waitqueue_head(&c->wq);
+    etx_lazy_init(&c->ring_mem, sizeof(*c->ring) * AHT20_RING_LEN, aht20_ring_attach);
+}
+
+/* Report-by-exception: is @data different enough from what readers last saw? */
+static bool aht20_outside_deadband(const struct aht20_chan *c,
+                                   const struct aht20_data *data, u64 now_ns)
+{
+    const struct aht20_sample *last = &c->last;
+    unsigned int age_ms;
+
+    if (!deadband_temp && !deadband_hum && !deadband_max_age_ms)
+        return true;
+    if (!c->seq)
+        return true;
+
+    if (abs(data->temperature - last->temperature) > deadband_temp ||
+        abs(data->humidity - last->humidity) > deadband_hum)
+        return true;
+
+    age_ms = div_u64(now_ns - c->pub_mono_ns, NSEC_PER_MSEC);
+    return deadband_max_age_ms && age_ms >= deadband_max_age_ms;
+}
+
+static void aht20_publish(struct aht20_chan *c, const struct aht20_data *data, u64 ts)
+{
+    struct aht20_sample *s;
+    unsigned long flags;
+    u64 now_ns = ktime_get_ns();
+
+    spin_lock_irqsave(&c->lock, flags);
+    if (!aht20_outside_deadband(c, data, now_ns)) {
+        spin_unlock_irqrestore(&c->lock, flags);
+        return;
+    }
+    c->pub_mono_ns = now_ns;
+    s = &c->last;
+    s->timestamp_ns = ts;
+    s->seq          = (u32)c->seq;
+    s->temperature  = data->temperature;
+    s->humidity     = data->humidity;
+    s->reserved     = 0;
+    if (c->ring)
+        c->ring[c->seq % AHT20_RING_LEN] = *s;
+    c->seq++;
+    spin_unlock_irqrestore(&c->lock, flags);
+
+    wake_up_interruptible(&c->wq);
+}
+
+#if ETX_HISTORY
+static void hist_record(struct aht20_sensor *s, const struct aht20_data *data, u64 ts);
+#else
+static inline void hist_record(struct aht20_sensor *s, const struct aht20_data *data, u64 ts) {}
+#endif
+
+/*
+ * Self-heating: a conversion may start only once the previous one on
+ * the same sensor is at least 100/max_duty_pct conversion times ago.
+ * Caller holds aht20_lock.
+ */
+static bool aht20_may_convert(const struct aht20_sensor *s, u64 now_ns)
+{
+    unsigned int pct = READ_ONCE(max_duty_pct);
+    u64 gap_ns;
+
+    if (!pct || !s->conv_ns)
+        return true;
+    gap_ns = div_u64((u64)AHT20_CONV_MS * NSEC_PER_MSEC * 100, pct);
+    return now_ns - s->conv_ns >= gap_ns;
+}
+
+/* Account a conversion started at @start_ns; caller holds aht20_lock */
+static void aht20_conv_done(struct aht20_sensor *s, u64 start_ns, u64 ts,
+                            const struct aht20_data *data, int ret)
+{
+    u64 busy_ns = ktime_get_ns() - start_ns;
+    unsigned long flags;
+    unsigned int duty;
+
+    s->conv_busy_ns = busy_ns;
+    if (s->conv_ns) {
+        duty = min_t(u64, div64_u64(busy_ns * 1000, start_ns - s->conv_ns), 1000);
+        s->duty_permille = (s->duty_permille * 7 + duty) / 8;
+    }
+    s->conv_ns = start_ns;
+
+    /* Also under chan.lock, for readers that cannot wait for aht20_lock */
+    if (!ret) {
+        spin_lock_irqsave(&s->chan.lock, flags);
+        s->cache.data    = *data;
+        s->cache.ts      = ts;
+        s->cache.mono_ns = start_ns;
+        s->cache_valid   = true;
+        spin_unlock_irqrestore(&s->chan.lock, flags);
+    }
+}
+
+/*
+ * A reading of @s at most @max_age_ns old: the cached one if it is
+ * young enough, else trigger, wait for and convert a new one and
+ * publish it. Too soon after the last conversion the cached one is
+ * returned whatever its age. A cache hit only takes chan.lock, so it
+ * does not wait behind a sampler round holding aht20_lock.
+ */
+static int aht20_measure(struct aht20_sensor *s, u64 max_age_ns, struct aht20_reading *out)
+{
+    struct aht20_data data;
+    unsigned long flags;
+    bool hit;
+    u64 ts, start;
+    int ret;
+
+    spin_lock_irqsave(&s->chan.lock, flags);
+    hit = s->cache_valid && ktime_get_ns() - s->cache.mono_ns <= max_age_ns;
+    if (hit)
+        *out = s->cache;
+    spin_unlock_irqrestore(&s->chan.lock, flags);
+    if (hit)
+        return 0;
+
+    mutex_lock(&aht20_lock);
+    start = ktime_get_ns();
+    if (s->cache_valid &&
+        (start - s->cache.mono_ns <= max_age_ns || !aht20_may_convert(s, start))) {
+        *out = s->cache;
+        mutex_unlock(&aht20_lock);
+        return 0;
+    }
+    if (!aht20_may_convert(s, start)) {
+        mutex_unlock(&aht20_lock);
+        return -EAGAIN;
+    }
+    ts  = ktime_get_real_ns();
+    ret = etx_aht20_measure(s->client, &data.temperature, &data.humidity);
+    aht20_conv_done(s, start, ts, &data, ret);
+    *out = s->cache;
+    mutex_unlock(&aht20_lock);
+    if (ret < 0)
+        return ret;
+
+    hist_record(s, &data, ts);
+    aht20_publish(&s->chan, &data, ts);
+    return 0;
+}
+
+#if ETX_ZONES
+/* Aggregate one round's results per zone and publish the zone means */
+static void aht20_update_zones(const struct aht20_data *data, const int *ret, u64 ts)
 {
-    u8 cmd[3] = {0xAC, 0x33, 0x00};
-    return i2c_master_send(aht20_client, cmd, 3);
+    struct aht20_zone_stats st;
+    struct aht20_data mean;
+    struct aht20_zone *zone;
+    unsigned long flags;
+    unsigned int z, i;
+    s32 tsum, hsum;
+
+    for (z = 0; z < AHT20_MAX_ZONES; z++) {
+        memset(&st, 0, sizeof(st));
+        st.zone         = z;
+        st.timestamp_ns = ts;
+        tsum = hsum = 0;
+
+        for (i = 0; i < aht20_nsensors; i++) {
+            if (aht20_sensors[i].zone != z || ret[i])
+                continue;
+            if (!st.sensors++) {
+                st.temp_min = st.temp_max = data[i].temperature;
+                st.hum_min  = st.hum_max  = data[i].humidity;
+            }
+            st.temp_min = min(st.temp_min, data[i].temperature);
+            st.temp_max = max(st.temp_max, data[i].temperature);
+            st.hum_min  = min(st.hum_min, data[i].humidity);
+            st.hum_max  = max(st.hum_max, data[i].humidity);
+            tsum += data[i].temperature;
+            hsum += data[i].humidity;
+        }
+        if (!st.sensors)
+            continue;
+
+        st.temp_mean   = DIV_ROUND_CLOSEST(tsum, (s32)st.sensors);
+        st.hum_mean    = DIV_ROUND_CLOSEST(hsum, (s32)st.sensors);
+        st.temp_spread = st.temp_max - st.temp_min;
+        st.hum_spread  = st.hum_max - st.hum_min;
+
+        zone = &aht20_zones[z];
+        spin_lock_irqsave(&zone->chan.lock, flags);
+        zone->stats = st;
+        spin_unlock_irqrestore(&zone->chan.lock, flags);
+
+        mean.temperature = st.temp_mean;
+        mean.humidity    = st.hum_mean;
+        aht20_publish(&zone->chan, &mean, ts);
+    }
+}
+
+/* Channel of @zone, NULL if no sensor is assigned to it */
+static struct aht20_chan *aht20_zone_chan(unsigned int zone)
+{
+    unsigned int i;
+
+    for (i = 0; i < aht20_nsensors; i++)
+        if (aht20_sensors[i].zone == zone)
+            return &aht20_zones[zone].chan;
+    return NULL;
 }
+#else
+static inline void aht20_update_zones(const struct aht20_data *data, const int *ret, u64 ts) {}
+static inline struct aht20_chan *aht20_zone_chan(unsigned int zone) { return NULL; }
+#endif
 
-static int aht20_read_raw(u32 *t, u32 *h)
+/*
+ * One sampling round: every sensor is triggered back to back, the
+ * conversion time is waited out once for all of them, then all are read
+ * and the zone aggregates are refreshed. Sensors held back by the duty
+ * cycle publish nothing and feed their cached value to the zones.
+ */
+static void aht20_round(void)
 {
-    u8 d[6];
+    struct aht20_data data[AHT20_MAX_SENSORS];
+    int ret[AHT20_MAX_SENSORS];
+    bool conv[AHT20_MAX_SENSORS];
+    struct aht20_sensor *s;
+    unsigned int i, nconv = 0;
+    u64 ts, start;
 
-    msleep(80);
-    i2c_master_recv(aht20_client, d, 6);
+    mutex_lock(&aht20_lock);
+    ts    = ktime_get_real_ns();
+    start = ktime_get_ns();
+    for (i = 0; i < aht20_nsensors; i++) {
+        s = &aht20_sensors[i];
+        conv[i] = aht20_may_convert(s, start);
+        if (!conv[i]) {
+            data[i] = s->cache.data;
+            ret[i]  = s->cache_valid ? 0 : -EAGAIN;
+            continue;
+        }
+        ret[i] = etx_aht20_trigger(s->client);
+        nconv++;
+    }
+    if (nconv)
+        msleep(AHT20_CONV_MS);
+    for (i = 0; i < aht20_nsensors; i++) {
+        if (!conv[i])
+            continue;
+        s = &aht20_sensors[i];
+        if (!ret[i])
+            ret[i] = etx_aht20_fetch(s->client, &data[i].temperature, &data[i].humidity);
+        aht20_conv_done(s, start, ts, &data[i], ret[i]);
+    }
+    mutex_unlock(&aht20_lock);
+
+    for (i = 0; i < aht20_nsensors; i++) {
+        if (!conv[i])
+            continue;
+        if (ret[i]) {
+            pr_warn_ratelimited("AHT20: sensor %u sample failed (%d)\n", i, ret[i]);
+            continue;
+        }
+        hist_record(&aht20_sensors[i], &data[i], ts);
+        aht20_publish(&aht20_sensors[i].chan, &data[i], ts);
+    }
+    aht20_update_zones(data, ret, ts);
+}
+
+/* ===================== ASYNC READS ===================== */
+
+static void aht20_async_work(struct work_struct *work)
+{
+    struct aht20_sensor *s = container_of(work, struct aht20_sensor, async_work);
+    struct aht20_reading rd;
+    unsigned long flags;
+    u64 ticket;
+    int ret;
+
+    spin_lock_irqsave(&s->chan.lock, flags);
+    ticket = s->async_req;
+    s->async_started = ticket;
+    spin_unlock_irqrestore(&s->chan.lock, flags);
+
+    ret = aht20_measure(s, 0, &rd);
+
+    spin_lock_irqsave(&s->chan.lock, flags);
+    s->async_rd   = rd;
+    s->async_ret  = ret;
+    s->async_done = ticket;
+    spin_unlock_irqrestore(&s->chan.lock, flags);
+
+    wake_up_interruptible(&s->chan.wq);
+}
+
+static u64 aht20_trigger(struct aht20_sensor *s)
+{
+    unsigned long flags;
+    u64 ticket;
+
+    spin_lock_irqsave(&s->chan.lock, flags);
+    /* Nothing queued that has not started yet: issue a new ticket */
+    if (s->async_req == s->async_started)
+        s->async_req++;
+    ticket = s->async_req;
+    spin_unlock_irqrestore(&s->chan.lock, flags);
+
+    queue_work(system_wq, &s->async_work);
+    return ticket;
+}
+
+static bool aht20_ticket_done(struct aht20_sensor *s, u64 ticket)
+{
+    return READ_ONCE(s->async_done) >= ticket;
+}
+
+static int aht20_collect(struct file *f, struct aht20_reader *r,
+                         struct aht20_ticket __user *arg)
+{
+    struct aht20_sensor *s = r->sensor;
+    struct aht20_reading rd;
+    struct aht20_ticket t;
+    unsigned long flags;
+    int ret;
+
+    if (get_user(t.ticket, &arg->ticket))
+        return -EFAULT;
+    if (!t.ticket || t.ticket > READ_ONCE(s->async_req))
+        return -EINVAL;
 
-    *h = ((d[1] << 12) | (d[2] << 4) | (d[3] >> 4));
-    *t = (((d[3] & 0x0F) << 16) | (d[4] << 8) | d[5]);
+    if (!aht20_ticket_done(s, t.ticket)) {
+        if (f->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(s->chan.wq, aht20_ticket_done(s, t.ticket));
+        if (ret)
+            return ret;
+    }
+
+    spin_lock_irqsave(&s->chan.lock, flags);
+    rd  = s->async_rd;
+    ret = s->async_ret;
+    spin_unlock_irqrestore(&s->chan.lock, flags);
+    if (t.ticket >= r->ticket)
+        r->ticket = 0;
+    if (ret < 0)
+        return ret;
+
+    t.timestamp_ns = rd.ts;
+    t.temperature  = rd.data.temperature;
+    t.humidity     = rd.data.humidity;
+    return copy_to_user(arg, &t, sizeof(t)) ? -EFAULT : 0;
+}
+
+/* ===================== SUBSCRIPTIONS ===================== */
+
+/* Ask the sampler for the fastest subscribed rate; caller holds aht20_sub_lock */
+static void aht20_sub_update(void)
+{
+    struct aht20_reader *r;
+    unsigned int period_ms = 0;
+
+    list_for_each_entry(r, &aht20_subs, sub)
+        if (!period_ms || r->period_ms < period_ms)
+            period_ms = r->period_ms;
+    etx_sampler_request(period_ms);
+}
+
+static int aht20_subscribe(struct aht20_reader *r, u32 period_ms)
+{
+    if (period_ms && period_ms < AHT20_CONV_MS)
+        return -EINVAL;
+
+    mutex_lock(&aht20_sub_lock);
+    if (r->period_ms)
+        list_del(&r->sub);
+    WRITE_ONCE(r->period_ms, period_ms);
+    r->due_ns = 0;
+    if (period_ms)
+        list_add(&r->sub, &aht20_subs);
+    aht20_sub_update();
+    mutex_unlock(&aht20_sub_lock);
     return 0;
 }
 
+/*
+ * Decimation: deliver a sample once it is at least one subscription
+ * period after the previous delivery, less half a sampler period so
+ * trigger jitter cannot make a reader skip a whole round.
+ */
+static bool aht20_due(const struct aht20_reader *r, u64 timestamp_ns)
+{
+    u64 slack = (u64)etx_sampler_period_ms() * NSEC_PER_MSEC / 2;
+
+    return !READ_ONCE(r->period_ms) || timestamp_ns + slack >= r->due_ns;
+}
+
+static void aht20_delivered(struct aht20_reader *r, u64 timestamp_ns)
+{
+    unsigned int period_ms = READ_ONCE(r->period_ms);
+
+    if (period_ms)
+        r->due_ns = timestamp_ns + (u64)period_ms * NSEC_PER_MSEC;
+}
+
 /* AHT20 CHAR OPS */
-static long aht20_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+/* Minors [0, AHT20_MAX_SENSORS) are sensors, the zone channels follow */
+static int aht20_open(struct inode *inode, struct file *f)
 {
-    struct aht20_data data;
-    u32 rt, rh;
+    unsigned int minor = iminor(inode);
+    struct aht20_sensor *sensor = NULL;
+    struct aht20_chan *chan;
+    struct aht20_reader *r;
+    unsigned long flags;
+    int ret;
+
+    if (minor < AHT20_MAX_SENSORS) {
+        if (minor >= aht20_nsensors)
+            return -ENODEV;
+        sensor = &aht20_sensors[minor];
+        chan   = &sensor->chan;
+    } else {
+        chan = aht20_zone_chan(minor - AHT20_MAX_SENSORS);
+        if (!chan)
+            return -ENODEV;
+    }
 
-    if (cmd != AHT20_READ_DATA)
+    r = kzalloc(sizeof(*r), GFP_KERNEL);
+    if (!r)
+        return -ENOMEM;
+    ret = etx_lazy_get(&chan->ring_mem);
+    if (ret) {
+        kfree(r);
+        return ret;
+    }
+    r->chan   = chan;
+    r->sensor = sensor;
+
+    /* New readers start with the next sample, not the backlog */
+    spin_lock_irqsave(&chan->lock, flags);
+    r->next_seq = chan->seq;
+    spin_unlock_irqrestore(&chan->lock, flags);
+
+    f->private_data = r;
+    return stream_open(inode, f);
+}
+
+static int aht20_release(struct inode *inode, struct file *f)
+{
+    struct aht20_reader *r = f->private_data;
+
+    if (r->period_ms)
+        aht20_subscribe(r, 0);
+    etx_lazy_put(&r->chan->ring_mem);
+    kfree(r);
+    return 0;
+}
+
+/* Timestamps only grow, so if the newest sample is not due none is */
+static bool aht20_readable(struct aht20_reader *r)
+{
+    struct aht20_chan *c = r->chan;
+    unsigned long flags;
+    bool ret;
+
+    spin_lock_irqsave(&c->lock, flags);
+    ret = c->seq > r->next_seq && aht20_due(r, c->last.timestamp_ns);
+    spin_unlock_irqrestore(&c->lock, flags);
+    return ret;
+}
+
+/*
+ * read_iter so that splice() into a pipe works through copy_splice_read();
+ * samples are never split, a short buffer gets only whole records.
+ */
+static ssize_t aht20_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct file *f = iocb->ki_filp;
+    struct aht20_reader *r = f->private_data;
+    struct aht20_chan *c = r->chan;
+    size_t len = iov_iter_count(to);
+    struct aht20_sample s;
+    unsigned long flags;
+    size_t done = 0;
+    int ret;
+
+    if (len < sizeof(s))
         return -EINVAL;
 
-    aht20_trigger();
-    aht20_read_raw(&rt, &rh);
+    /* Another reader sharing this file may have taken what woke us */
+    while (!done) {
+        if (!aht20_readable(r)) {
+            if ((f->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))
+                return -EAGAIN;
+            ret = wait_event_interruptible(c->wq, aht20_readable(r));
+            if (ret)
+                return ret;
+        }
+
+        while (done + sizeof(s) <= len) {
+            spin_lock_irqsave(&c->lock, flags);
+            if (r->next_seq >= c->seq) {
+                spin_unlock_irqrestore(&c->lock, flags);
+                break;
+            }
+            /* Fell behind: skip what has already been overwritten */
+            if (c->seq - r->next_seq > AHT20_RING_LEN)
+                r->next_seq = c->seq - AHT20_RING_LEN;
+            s = c->ring[r->next_seq % AHT20_RING_LEN];
+            r->next_seq++;
+            if (!aht20_due(r, s.timestamp_ns)) {
+                spin_unlock_irqrestore(&c->lock, flags);
+                continue;
+            }
+            aht20_delivered(r, s.timestamp_ns);
+            spin_unlock_irqrestore(&c->lock, flags);
+
+            if (copy_to_iter(&s, sizeof(s), to) != sizeof(s))
+                return done ? done : -EFAULT;
+            done += sizeof(s);
+        }
+    }
+
+    return done;
+}
+
+static __poll_t aht20_poll(struct file *f, struct poll_table_struct *wait)
+{
+    struct aht20_reader *r = f->private_data;
+    u64 ticket = READ_ONCE(r->ticket);
+    __poll_t mask = 0;
 
-    data.humidity    = (rh * 1000) / 1048576;
-    data.temperature = ((rt * 2000) / 1048576) - 500;
+    poll_wait(f, &r->chan->wq, wait);
+    if (aht20_readable(r))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (ticket && aht20_ticket_done(r->sensor, ticket))
+        mask |= EPOLLPRI;
+    return mask;
+}
 
-    if (copy_to_user((void *)arg, &data, sizeof(data)))
+#if ETX_ZONES
+static int aht20_read_zone(struct aht20_zone_stats __user *arg)
+{
+    struct aht20_zone_stats st;
+    struct aht20_zone *zone;
+    unsigned long flags;
+    u32 z;
+
+    if (get_user(z, &arg->zone))
         return -EFAULT;
+    if (z >= AHT20_MAX_ZONES)
+        return -EINVAL;
 
-    return 0;
+    zone = &aht20_zones[z];
+    spin_lock_irqsave(&zone->chan.lock, flags);
+    st = zone->stats;
+    spin_unlock_irqrestore(&zone->chan.lock, flags);
+    if (!st.sensors)
+        return -ENODATA;
+
+    return copy_to_user(arg, &st, sizeof(st)) ? -EFAULT : 0;
+}
+#endif
+
+/*
+ * Convert only if it fits before @deadline_ns (CLOCK_MONOTONIC): not
+ * while another conversion holds the sensor, and not if the last one
+ * took longer than what is left. Otherwise hand out the cache; held
+ * back by the duty cycle alone that is not a deadline miss.
+ */
+static int aht20_measure_by(struct aht20_sensor *s, u64 deadline_ns, struct aht20_reading *out,
+                            u32 *flags)
+{
+    struct aht20_data data;
+    unsigned long irqflags;
+    u64 ts, start, need;
+    bool miss = true;
+    int ret;
+
+    *flags = 0;
+    if (mutex_trylock(&aht20_lock)) {
+        start = ktime_get_ns();
+        need  = s->conv_busy_ns ?: (u64)AHT20_CONV_MS * NSEC_PER_MSEC;
+        miss  = start + need > deadline_ns;
+        if (!miss && aht20_may_convert(s, start)) {
+            ts  = ktime_get_real_ns();
+            ret = etx_aht20_measure(s->client, &data.temperature, &data.humidity);
+            aht20_conv_done(s, start, ts, &data, ret);
+            *out = s->cache;
+            mutex_unlock(&aht20_lock);
+            if (ret < 0)
+                return ret;
+
+            hist_record(s, &data, ts);
+            aht20_publish(&s->chan, &data, ts);
+            if (ktime_get_ns() > deadline_ns) {
+                *flags = AHT20_READ_LATE;
+                atomic_inc(&s->deadline_misses);
+            }
+            return 0;
+        }
+        mutex_unlock(&aht20_lock);
+    }
+
+    spin_lock_irqsave(&s->chan.lock, irqflags);
+    ret  = s->cache_valid ? 0 : -ETIME;
+    *out = s->cache;
+    spin_unlock_irqrestore(&s->chan.lock, irqflags);
+    *flags = AHT20_READ_CACHED;
+    if (miss)
+        atomic_inc(&s->deadline_misses);
+    return ret;
+}
+
+static int aht20_read_deadline(struct aht20_sensor *s, struct aht20_deadline __user *arg)
+{
+    struct aht20_reading rd;
+    struct aht20_deadline dl;
+    int ret;
+
+    if (copy_from_user(&dl, arg, sizeof(dl)))
+        return -EFAULT;
+
+    ret = aht20_measure_by(s, ktime_get_ns() + (u64)dl.budget_us * NSEC_PER_USEC, &rd,
+                           &dl.flags);
+    if (ret < 0)
+        return ret;
+
+    dl.timestamp_ns = rd.ts;
+    dl.temperature  = rd.data.temperature;
+    dl.humidity     = rd.data.humidity;
+    return copy_to_user(arg, &dl, sizeof(dl)) ? -EFAULT : 0;
+}
+
+static int aht20_read_fresh(struct aht20_sensor *s, struct aht20_fresh __user *arg)
+{
+    struct aht20_reading rd;
+    struct aht20_fresh fr;
+    u64 age_ms;
+    int ret;
+
+    if (copy_from_user(&fr, arg, sizeof(fr)))
+        return -EFAULT;
+
+    ret = aht20_measure(s, (u64)fr.max_age_ms * NSEC_PER_MSEC, &rd);
+    if (ret < 0)
+        return ret;
+
+    age_ms          = div_u64(ktime_get_ns() - rd.mono_ns, NSEC_PER_MSEC);
+    fr.age_ms       = min_t(u64, age_ms, U32_MAX);
+    fr.timestamp_ns = rd.ts;
+    fr.temperature  = rd.data.temperature;
+    fr.humidity     = rd.data.humidity;
+    return copy_to_user(arg, &fr, sizeof(fr)) ? -EFAULT : 0;
+}
+
+static long aht20_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+    struct aht20_reader *r = f->private_data;
+    struct aht20_reading rd;
+    u32 period_ms;
+    u64 ticket;
+    int ret;
+
+    switch (cmd) {
+    case AHT20_READ_DATA:
+        if (!r->sensor)
+            return -EINVAL;
+        ret = aht20_measure(r->sensor, 0, &rd);
+        if (ret < 0)
+            return ret;
+        if (copy_to_user((void *)arg, &rd.data, sizeof(rd.data)))
+            return -EFAULT;
+        return 0;
+    case AHT20_READ_FRESH:
+        if (!r->sensor)
+            return -EINVAL;
+        return aht20_read_fresh(r->sensor, (struct aht20_fresh __user *)arg);
+    case AHT20_TRIGGER:
+        if (!r->sensor)
+            return -EINVAL;
+        ticket = aht20_trigger(r->sensor);
+        WRITE_ONCE(r->ticket, ticket);
+        return put_user(ticket, (u64 __user *)arg);
+    case AHT20_COLLECT:
+        if (!r->sensor)
+            return -EINVAL;
+        return aht20_collect(f, r, (struct aht20_ticket __user *)arg);
+    case AHT20_READ_DEADLINE:
+        if (!r->sensor)
+            return -EINVAL;
+        return aht20_read_deadline(r->sensor, (struct aht20_deadline __user *)arg);
+#if ETX_ZONES
+    case AHT20_READ_ZONE:
+        return aht20_read_zone((struct aht20_zone_stats __user *)arg);
+#endif
+    case AHT20_SUBSCRIBE:
+        if (get_user(period_ms, (u32 __user *)arg))
+            return -EFAULT;
+        return aht20_subscribe(r, period_ms);
+    default:
+        return -EINVAL;
+    }
 }
 
 static struct file_operations aht20_fops = {
     .owner          = THIS_MODULE,
+    .open           = aht20_open,
+    .release        = aht20_release,
+    .read_iter      = aht20_read_iter,
+    .splice_read    = copy_splice_read,
+    .poll           = aht20_poll,
     .unlocked_ioctl = aht20_ioctl,
 };
 
+/* ===================== AHT20 HISTORY ===================== */
+#if ETX_HISTORY
+
+static DEFINE_MUTEX(hist_lock);
+
+/* Snapshot taken at open, served by read() */
+struct hist_export {
+    u8     *buf;
+    size_t  len;
+};
+
+static void hist_attach(struct etx_lazy *l, void *buf)
+{
+    struct aht20_sensor *s = container_of(l, struct aht20_sensor, hist_mem);
+
+    mutex_lock(&hist_lock);
+    s->hist       = buf;
+    s->hist_head  = 0;
+    s->hist_count = 0;
+    mutex_unlock(&hist_lock);
+}
+
+static void hist_record(struct aht20_sensor *s, const struct aht20_data *data, u64 ts)
+{
+    struct hist_rec *r;
+
+    if (!history_len)
+        return;
+
+    /* The first sample allocates the ring; it is kept until unload */
+    if (!xchg(&s->hist_held, true) && etx_lazy_get(&s->hist_mem)) {
+        WRITE_ONCE(s->hist_held, false);
+        return;
+    }
+
+    mutex_lock(&hist_lock);
+    if (!s->hist) {
+        mutex_unlock(&hist_lock);
+        return;
+    }
+    r = &s->hist[s->hist_head];
+    r->ts_ms       = div_u64(ts, NSEC_PER_MSEC);
+    r->temperature = data->temperature;
+    r->humidity    = data->humidity;
+    s->hist_head = (s->hist_head + 1) % history_len;
+    if (s->hist_count < history_len)
+        s->hist_count++;
+    mutex_unlock(&hist_lock);
+}
+
+static u64 zigzag(s64 v)
+{
+    return ((u64)v << 1) ^ (u64)(v >> 63);
+}
+
+/* LEB128; with @out NULL only the length is computed */
+static size_t put_varint(u8 *out, u64 v)
+{
+    size_t n = 0;
+
+    do {
+        if (out)
+            out[n] = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+        n++;
+        v >>= 7;
+    } while (v);
+    return n;
+}
+
+static size_t hist_put_group(u8 *out, u32 run, const s64 d[3])
+{
+    size_t n = put_varint(out, run);
+    int i;
+
+    for (i = 0; i < 3; i++)
+        n += put_varint(out ? out + n : NULL, zigzag(d[i]));
+    return n;
+}
+
+/* Encode @count records, oldest first */
+static size_t hist_encode(const struct hist_rec *recs, unsigned int count, u8 *out)
+{
+    const struct hist_rec *r;
+    s64 prev_ts = 0, prev_dt = 0, prev_t = 0, prev_h = 0;
+    s64 d[3], run_d[3] = {0, 0, 0};
+    unsigned int i;
+    size_t n = 0;
+    u32 run = 0;
+
+    for (i = 0; i < count; i++) {
+        r = &recs[i];
+        d[0] = ((s64)r->ts_ms - prev_ts) - prev_dt;
+        d[1] = r->temperature - prev_t;
+        d[2] = r->humidity - prev_h;
+        prev_dt = r->ts_ms - prev_ts;
+        prev_ts = r->ts_ms;
+        prev_t  = r->temperature;
+        prev_h  = r->humidity;
+
+        if (run && !memcmp(d, run_d, sizeof(d))) {
+            run++;
+            continue;
+        }
+        if (run)
+            n += hist_put_group(out ? out + n : NULL, run, run_d);
+        memcpy(run_d, d, sizeof(d));
+        run = 1;
+    }
+    if (run)
+        n += hist_put_group(out ? out + n : NULL, run, run_d);
+    return n;
+}
+
+/* One minor per sensor */
+static int hist_open(struct inode *inode, struct file *f)
+{
+    unsigned int minor = iminor(inode);
+    struct aht20_sensor *s;
+    struct hist_export *e;
+    struct aht20_hist_hdr hdr = {
+        .magic   = cpu_to_le32(AHT20_HIST_MAGIC),
+        .version = cpu_to_le16(AHT20_HIST_VERSION),
+    };
+    struct hist_rec *snap;
+    unsigned int cap, count, start, first;
+    size_t body;
+
+    if (minor >= aht20_nsensors || !history_len)
+        return -ENODEV;
+    s = &aht20_sensors[minor];
+
+    e = kzalloc(sizeof(*e), GFP_KERNEL);
+    if (!e)
+        return -ENOMEM;
+
+    /*
+     * Copy the ring out oldest-first and encode the copy, so the sampler
+     * only waits for a memcpy. Sized before locking, so records that
+     * arrive in between push the oldest ones out of the copy.
+     */
+    cap  = max(READ_ONCE(s->hist_count), 1U);
+    snap = kvmalloc_array(cap, sizeof(*snap), GFP_KERNEL);
+    if (!snap) {
+        kfree(e);
+        return -ENOMEM;
+    }
+    mutex_lock(&hist_lock);
+    count = s->hist ? min(s->hist_count, cap) : 0;
+    if (count) {
+        start = (s->hist_head + history_len - count) % history_len;
+        first = min(count, history_len - start);
+        memcpy(snap, &s->hist[start], first * sizeof(*snap));
+        memcpy(snap + first, s->hist, (count - first) * sizeof(*snap));
+    }
+    mutex_unlock(&hist_lock);
+
+    body = hist_encode(snap, count, NULL);
+    e->buf = kvmalloc(sizeof(hdr) + body, GFP_KERNEL);
+    if (!e->buf) {
+        kvfree(snap);
+        kfree(e);
+        return -ENOMEM;
+    }
+    hist_encode(snap, count, e->buf + sizeof(hdr));
+    kvfree(snap);
+
+    hdr.count = cpu_to_le32(count);
+    hdr.bytes = cpu_to_le32(body);
+    memcpy(e->buf, &hdr, sizeof(hdr));
+    e->len = sizeof(hdr) + body;
+
+    f->private_data = e;
+    return 0;
+}
+
+static int hist_release(struct inode *inode, struct file *f)
+{
+    struct hist_export *e = f->private_data;
+
+    kvfree(e->buf);
+    kfree(e);
+    return 0;
+}
+
+static ssize_t hist_read(struct file *f, char __user *buf, size_t len, loff_t *off)
+{
+    struct hist_export *e = f->private_data;
+
+    return simple_read_from_buffer(buf, len, off, e->buf, e->len);
+}
+
+static struct file_operations hist_fops = {
+    .owner   = THIS_MODULE,
+    .open    = hist_open,
+    .release = hist_release,
+    .read    = hist_read,
+    .llseek  = default_llseek,
+};
+
+static void hist_init(struct aht20_sensor *s)
+{
+    etx_lazy_init(&s->hist_mem, array_size(history_len, sizeof(*s->hist)), hist_attach);
+}
+
+static void hist_exit(struct aht20_sensor *s)
+{
+    etx_lazy_exit(&s->hist_mem);
+    s->hist_held = false;
+}
+#endif /* ETX_HISTORY */
+
+/* ===================== BOOT TIMING ===================== */
+#if ETX_TIMING
+enum boot_phase {
+    PHASE_ADAPTER,       /* i2c_get_adapter() */
+    PHASE_CLIENTS,       /* OLED and AHT20 client devices, history included */
+    PHASE_OLED_POWER,    /* supplies, reset, init table and first frame */
+    PHASE_AHT20_INIT,    /* etx_aht20_init() in probe, summed over sensors */
+    PHASE_CHRDEV,        /* char device regions and cdevs */
+    PHASE_SAMPLER,       /* sampler start */
+    PHASE_TOTAL,         /* whole module init, probes included */
+    PHASE_COUNT
+};
+
+static const char * const boot_phase_names[PHASE_COUNT] = {
+    [PHASE_ADAPTER]    = "adapter_lookup",
+    [PHASE_CLIENTS]    = "client_create",
+    [PHASE_OLED_POWER] = "oled_power_on",
+    [PHASE_AHT20_INIT] = "aht20_init",
+    [PHASE_CHRDEV]     = "chrdev_register",
+    [PHASE_SAMPLER]    = "sampler_start",
+    [PHASE_TOTAL]      = "total",
+};
+
+static s64 boot_phase_us[PHASE_COUNT];
+static struct dentry *etx_debugfs;
+
+static void boot_phase_end(enum boot_phase phase, ktime_t start)
+{
+    boot_phase_us[phase] += ktime_us_delta(ktime_get(), start);
+}
+
+static int boot_timing_show(struct seq_file *s, void *unused)
+{
+    int i;
+
+    for (i = 0; i < PHASE_COUNT; i++)
+        seq_printf(s, "%-16s %8lld us\n", boot_phase_names[i], boot_phase_us[i]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(boot_timing);
+#else
+#define boot_phase_end(phase, start)    do { (void)(start); } while (0)
+#endif /* ETX_TIMING */
+
 /* ===================== I2C PROBE ===================== */
 
+static ssize_t power_up_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sysfs_emit(buf, "%u\n", etx_oled_powerup_us());
+}
+static DEVICE_ATTR_RO(power_up_us);
+
+/* Framebuffer memory currently allocated, 0 once released */
+static ssize_t fb_bytes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sysfs_emit(buf, "%zu\n", etx_oled_buffer_bytes());
+}
+static DEVICE_ATTR_RO(fb_bytes);
+
+/* Frame accounting: sent, dropped as stale, and sent past their deadline */
+static ssize_t frames_sent_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct etx_oled_stats st;
+
+    etx_oled_get_stats(&st);
+    return sysfs_emit(buf, "%llu\n", st.frames);
+}
+static DEVICE_ATTR_RO(frames_sent);
+
+static ssize_t frames_dropped_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct etx_oled_stats st;
+
+    etx_oled_get_stats(&st);
+    return sysfs_emit(buf, "%llu\n", st.dropped);
+}
+static DEVICE_ATTR_RO(frames_dropped);
+
+static ssize_t frames_late_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct etx_oled_stats st;
+
+    etx_oled_get_stats(&st);
+    return sysfs_emit(buf, "%llu\n", st.late);
+}
+static DEVICE_ATTR_RO(frames_late);
+
+static struct attribute *oled_attrs[] = {
+    &dev_attr_power_up_us.attr,
+    &dev_attr_fb_bytes.attr,
+    &dev_attr_frames_sent.attr,
+    &dev_attr_frames_dropped.attr,
+    &dev_attr_frames_late.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(oled);
+
+static struct aht20_sensor *aht20_sensor_of(struct device *dev)
+{
+    unsigned int i;
+
+    for (i = 0; i < aht20_nsensors; i++)
+        if (&aht20_sensors[i].client->dev == dev)
+            return &aht20_sensors[i];
+    return NULL;
+}
+
+/* Sample ring and history memory currently allocated for this sensor */
+static ssize_t ring_bytes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct aht20_sensor *s = aht20_sensor_of(dev);
+
+    return s ? sysfs_emit(buf, "%zu\n", etx_lazy_bytes(&s->chan.ring_mem)) : -ENODEV;
+}
+static DEVICE_ATTR_RO(ring_bytes);
+
+#if ETX_HISTORY
+static ssize_t history_bytes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct aht20_sensor *s = aht20_sensor_of(dev);
+
+    return s ? sysfs_emit(buf, "%zu\n", etx_lazy_bytes(&s->hist_mem)) : -ENODEV;
+}
+static DEVICE_ATTR_RO(history_bytes);
+#endif
+
+#if ETX_ZONES
+static ssize_t zone_ring_bytes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct aht20_sensor *s = aht20_sensor_of(dev);
+
+    return s ? sysfs_emit(buf, "%zu\n", etx_lazy_bytes(&aht20_zones[s->zone].chan.ring_mem))
+             : -ENODEV;
+}
+static DEVICE_ATTR_RO(zone_ring_bytes);
+#endif
+
+/* Health: one status byte, read without starting a conversion */
+static ssize_t busy_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    int st = etx_aht20_status(to_i2c_client(dev));
+
+    return st < 0 ? st : sysfs_emit(buf, "%d\n", !!(st & AHT20_STATUS_BUSY));
+}
+static DEVICE_ATTR_RO(busy);
+
+static ssize_t calibrated_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    int st = etx_aht20_status(to_i2c_client(dev));
+
+    return st < 0 ? st : sysfs_emit(buf, "%d\n", !!(st & AHT20_STATUS_CAL));
+}
+static DEVICE_ATTR_RO(calibrated);
+
+/* Share of time spent converting, 1/1000, smoothed over ~8 conversions */
+static ssize_t duty_permille_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct aht20_sensor *s = aht20_sensor_of(dev);
+
+    return s ? sysfs_emit(buf, "%u\n", READ_ONCE(s->duty_permille)) : -ENODEV;
+}
+static DEVICE_ATTR_RO(duty_permille);
+
+/* AHT20_READ_DEADLINE calls answered from the cache or finished late */
+static ssize_t deadline_misses_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct aht20_sensor *s = aht20_sensor_of(dev);
+
+    return s ? sysfs_emit(buf, "%d\n", atomic_read(&s->deadline_misses)) : -ENODEV;
+}
+static DEVICE_ATTR_RO(deadline_misses);
+
+static struct attribute *aht20_attrs[] = {
+    &dev_attr_busy.attr,
+    &dev_attr_calibrated.attr,
+    &dev_attr_duty_permille.attr,
+    &dev_attr_deadline_misses.attr,
+    &dev_attr_ring_bytes.attr,
+#if ETX_HISTORY
+    &dev_attr_history_bytes.attr,
+#endif
+#if ETX_ZONES
+    &dev_attr_zone_ring_bytes.attr,
+#endif
+    NULL,
+};
+ATTRIBUTE_GROUPS(aht20);
+
 static int oled_probe(struct i2c_client *client)
 {
-    oled_client = client;
-    oled_init();
+    ktime_t start;
+    int ret;
+
+    ret = etx_oled_attach(client);
+    if (ret)
+        return ret;
+
+    start = ktime_get();
+    ret = etx_oled_power_on();
+    boot_phase_end(PHASE_OLED_POWER, start);
+    if (ret) {
+        pr_err("SSD1306: init failed (%d)\n", ret);
+        etx_oled_detach();
+        return ret;
+    }
+
     pr_info("SSD1306 OLED probed\n");
     return 0;
 }
 
+static void oled_remove(struct i2c_client *client)
+{
+    etx_oled_power_off();
+    etx_oled_detach();
+}
+
 static int aht20_probe(struct i2c_client *client)
 {
-    aht20_client = client;
-    pr_info("AHT20 sensor probed\n");
+    ktime_t start;
+    int st, ret;
+
+    start = ktime_get();
+    ret = etx_aht20_init(client);
+    boot_phase_end(PHASE_AHT20_INIT, start);
+    if (ret)
+        pr_err("AHT20: calibration load failed on %s\n", client->adapter->name);
+    st = etx_aht20_status(client);
+    if (st >= 0 && !(st & AHT20_STATUS_CAL))
+        pr_warn("AHT20: not calibrated on %s (status 0x%02x)\n", client->adapter->name, st);
+    pr_info("AHT20 sensor probed on %s\n", client->adapter->name);
     return 0;
 }
 
@@ -168,13 +1655,20 @@ static const struct i2c_device_id aht20_id[] = {
 };
 
 static struct i2c_driver oled_driver = {
-    .driver = { .name = "ssd1306" },
+    .driver = {
+        .name       = "ssd1306",
+        .dev_groups = oled_groups,
+    },
     .probe  = oled_probe,
+    .remove = oled_remove,
     .id_table = oled_id,
 };
 
 static struct i2c_driver aht20_driver = {
-    .driver = { .name = "aht20" },
+    .driver = {
+        .name       = "aht20",
+        .dev_groups = aht20_groups,
+    },
     .probe  = aht20_probe,
     .id_table = aht20_id,
 };
@@ -188,46 +1682,163 @@ static struct i2c_board_info aht20_info = {
     I2C_BOARD_INFO("aht20", AHT20_ADDR),
 };
 
+static int aht20_add_sensors(void)
+{
+    struct aht20_sensor *s;
+    unsigned int zone;
+    int i;
+
+#if ETX_ZONES
+    for (i = 0; i < AHT20_MAX_ZONES; i++)
+        aht20_chan_init(&aht20_zones[i].chan);
+#endif
+
+    for (i = 0; i < aht20_nbus; i++) {
+        zone = i < aht20_nzone ? aht20_zone[i] : 0;
+        if (zone >= AHT20_MAX_ZONES) {
+            pr_err("AHT20: zone %u out of range for bus %d\n", zone, aht20_bus[i]);
+            continue;
+        }
+
+        s = &aht20_sensors[aht20_nsensors];
+        s->adap = i2c_get_adapter(aht20_bus[i]);
+        if (!s->adap) {
+            pr_err("AHT20: no adapter for bus %d\n", aht20_bus[i]);
+            continue;
+        }
+        s->client = i2c_new_client_device(s->adap, &aht20_info);
+        if (IS_ERR(s->client)) {
+            pr_err("AHT20: client on bus %d failed\n", aht20_bus[i]);
+            i2c_put_adapter(s->adap);
+            continue;
+        }
+        s->zone = zone;
+        aht20_chan_init(&s->chan);
+        INIT_WORK(&s->async_work, aht20_async_work);
+#if ETX_HISTORY
+        hist_init(s);
+#endif
+
+        pr_info("AHT20: sensor %u on bus %d, zone %u\n",
+                aht20_nsensors, aht20_bus[i], zone);
+        aht20_nsensors++;
+    }
+
+    return aht20_nsensors ? 0 : -ENODEV;
+}
+
+static void aht20_del_sensors(void)
+{
+    struct aht20_sensor *s;
+    unsigned int i;
+
+    for (i = 0; i < aht20_nsensors; i++) {
+        s = &aht20_sensors[i];
+        cancel_work_sync(&s->async_work);
+        etx_lazy_exit(&s->chan.ring_mem);
+#if ETX_HISTORY
+        hist_exit(s);
+#endif
+        i2c_unregister_device(s->client);
+        i2c_put_adapter(s->adap);
+    }
+    aht20_nsensors = 0;
+
+#if ETX_ZONES
+    for (i = 0; i < AHT20_MAX_ZONES; i++)
+        etx_lazy_exit(&aht20_zones[i].chan.ring_mem);
+#endif
+}
+
 static int __init etx_init(void)
 {
+    ktime_t init_start = ktime_get();
+    ktime_t start;
+    int ret;
+
+    start = ktime_get();
     i2c_adap = i2c_get_adapter(I2C_BUS_AVAILABLE);
+    boot_phase_end(PHASE_ADAPTER, start);
     if (!i2c_adap)
         return -ENODEV;
 
+    start = ktime_get();
+    etx_oled_board_add(I2C_BUS_AVAILABLE, SSD1306_ADDR);
     oled_client = i2c_new_client_device(i2c_adap, &oled_info);
-    if (IS_ERR(oled_client))
-        return PTR_ERR(oled_client);
+    if (IS_ERR(oled_client)) {
+        ret = PTR_ERR(oled_client);
+        goto err_board;
+    }
 
-    aht20_client = i2c_new_client_device(i2c_adap, &aht20_info);
-    if (IS_ERR(aht20_client))
-        return PTR_ERR(aht20_client);
+    ret = aht20_add_sensors();
+    boot_phase_end(PHASE_CLIENTS, start);
+    if (ret)
+        goto err_oled;
 
     i2c_add_driver(&oled_driver);
     i2c_add_driver(&aht20_driver);
 
     /* Char devices */
+    start = ktime_get();
     alloc_chrdev_region(&oled_dev, 0, 1, OLED_DEV_NAME);
     cdev_init(&oled_cdev, &oled_fops);
     cdev_add(&oled_cdev, oled_dev, 1);
 
-    alloc_chrdev_region(&aht20_dev, 0, 1, AHT20_DEV_NAME);
+    alloc_chrdev_region(&aht20_dev, 0, AHT20_MINORS, AHT20_DEV_NAME);
     cdev_init(&aht20_cdev, &aht20_fops);
-    cdev_add(&aht20_cdev, aht20_dev, 1);
+    cdev_add(&aht20_cdev, aht20_dev, AHT20_MINORS);
+
+#if ETX_HISTORY
+    alloc_chrdev_region(&hist_dev, 0, AHT20_MAX_SENSORS, HIST_DEV_NAME);
+    cdev_init(&hist_cdev, &hist_fops);
+    cdev_add(&hist_cdev, hist_dev, AHT20_MAX_SENSORS);
+#endif
+    boot_phase_end(PHASE_CHRDEV, start);
+
+    start = ktime_get();
+    ret = etx_sampler_start(aht20_round);
+    boot_phase_end(PHASE_SAMPLER, start);
+    if (ret)
+        pr_err("AHT20: sampler not started (%d)\n", ret);
+    boot_phase_end(PHASE_TOTAL, init_start);
+
+#if ETX_TIMING
+    /* Phase timings: cat /sys/kernel/debug/etx_i2c/timing */
+    etx_debugfs = debugfs_create_dir("etx_i2c", NULL);
+    debugfs_create_file("timing", 0444, etx_debugfs, NULL, &boot_timing_fops);
+#endif
 
     pr_info("ETX I2C Driver Loaded\n");
     return 0;
+
+err_oled:
+    i2c_unregister_device(oled_client);
+err_board:
+    etx_oled_board_remove();
+    i2c_put_adapter(i2c_adap);
+    return ret;
 }
 
 static void __exit etx_exit(void)
 {
+#if ETX_TIMING
+    debugfs_remove_recursive(etx_debugfs);
+#endif
+    etx_sampler_stop();
+
     cdev_del(&oled_cdev);
     cdev_del(&aht20_cdev);
 
     unregister_chrdev_region(oled_dev, 1);
-    unregister_chrdev_region(aht20_dev, 1);
+    unregister_chrdev_region(aht20_dev, AHT20_MINORS);
+#if ETX_HISTORY
+    cdev_del(&hist_cdev);
+    unregister_chrdev_region(hist_dev, AHT20_MAX_SENSORS);
+#endif
 
     i2c_unregister_device(oled_client);
-    i2c_unregister_device(aht20_client);
+    etx_oled_board_remove();
+    aht20_del_sensors();
 
     i2c_del_driver(&oled_driver);
     i2c_del_driver(&aht20_driver);
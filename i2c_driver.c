@@ -10,8 +10,16 @@
 #include <linux/init.h>
 #include <linux/slab.h>
 #include <linux/i2c.h>
-#include <linux/delay.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "etx_core.h"
+
+#ifndef ETX_TIMING
+#define ETX_TIMING          1              // debugfs boot phase timing (make ETX_TIMING=n)
+#endif
 
 #define I2C_BUS_AVAILABLE   (1)            // I2C bus number (usually 1 for Raspberry Pi)
 #define SLAVE_DEVICE_NAME   "ETX_OLED"     // OLED driver name
@@ -24,74 +32,97 @@ static struct i2c_adapter *etx_i2c_adapter     = NULL;
 static struct i2c_client  *etx_i2c_client_oled = NULL;
 static struct i2c_client  *etx_i2c_client_aht  = NULL;
 
-/* ==================== OLED FUNCTIONS (UNMODIFIED) ==================== */
+/* ==================== BOOT TIMING ==================== */
+#if ETX_TIMING
+static struct dentry *etx_debugfs;     // /sys/kernel/debug/etx_i2c
+
+enum etx_phase {
+    ETX_PHASE_ADAPTER,          // i2c_get_adapter()
+    ETX_PHASE_CLIENTS,          // i2c_new_client_device() for both devices
+    ETX_PHASE_DISPLAY_INIT,     // etx_oled_power_on(): supplies, reset, init table
+    ETX_PHASE_FILL,             // initial etx_oled_fill()
+    ETX_PHASE_AHT20_INIT,       // AHT20_Init()
+    ETX_PHASE_AHT20_READ,       // first AHT20_ReadData() in probe
+    ETX_PHASE_TOTAL,            // whole module init, probes included
+    ETX_PHASE_COUNT
+};
 
-static int I2C_Write(unsigned char *buf, unsigned int len)
-{
-    int ret = i2c_master_send(etx_i2c_client_oled, buf, len);
-    return ret;
-}
+static const char * const etx_phase_names[ETX_PHASE_COUNT] = {
+    [ETX_PHASE_ADAPTER]      = "adapter_lookup",
+    [ETX_PHASE_CLIENTS]      = "client_create",
+    [ETX_PHASE_DISPLAY_INIT] = "display_init",
+    [ETX_PHASE_FILL]         = "initial_fill",
+    [ETX_PHASE_AHT20_INIT]   = "aht20_init",
+    [ETX_PHASE_AHT20_READ]   = "aht20_first_read",
+    [ETX_PHASE_TOTAL]        = "total",
+};
 
-static void SSD1306_Write(bool is_cmd, unsigned char data)
-{
-    unsigned char buf[2];
-    buf[0] = is_cmd ? 0x00 : 0x40;
-    buf[1] = data;
-    I2C_Write(buf, 2);
-}
+static s64 etx_phase_us[ETX_PHASE_COUNT];
 
-static void SSD1306_DisplayInit(void)
+static void etx_phase_end(enum etx_phase phase, ktime_t start)
 {
-    msleep(100);
-    SSD1306_Write(true, 0xAE);
-    SSD1306_Write(true, 0xD5);
-    SSD1306_Write(true, 0x80);
-    SSD1306_Write(true, 0xA8);
-    SSD1306_Write(true, 0x3F);
-    SSD1306_Write(true, 0xD3);
-    SSD1306_Write(true, 0x00);
-    SSD1306_Write(true, 0x40);
-    SSD1306_Write(true, 0x8D);
-    SSD1306_Write(true, 0x14);
-    SSD1306_Write(true, 0x20);
-    SSD1306_Write(true, 0x00);
-    SSD1306_Write(true, 0xA1);
-    SSD1306_Write(true, 0xC8);
-    SSD1306_Write(true, 0xDA);
-    SSD1306_Write(true, 0x12);
-    SSD1306_Write(true, 0x81);
-    SSD1306_Write(true, 0x80);
-    SSD1306_Write(true, 0xD9);
-    SSD1306_Write(true, 0xF1);
-    SSD1306_Write(true, 0xDB);
-    SSD1306_Write(true, 0x20);
-    SSD1306_Write(true, 0xA4);
-    SSD1306_Write(true, 0xA6);
-    SSD1306_Write(true, 0x2E);
-    SSD1306_Write(true, 0xAF);
+    etx_phase_us[phase] += ktime_us_delta(ktime_get(), start);
 }
 
-static void SSD1306_Fill(unsigned char data)
+static int etx_timing_show(struct seq_file *s, void *unused)
 {
-    unsigned int total = 128 * 8;
-    unsigned int i;
+    int i;
 
-    for (i = 0; i < total; i++)
-        SSD1306_Write(false, data);
+    for (i = 0; i < ETX_PHASE_COUNT; i++)
+        seq_printf(s, "%-18s %8lld us\n", etx_phase_names[i], etx_phase_us[i]);
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(etx_timing);
+#else
+#define etx_phase_end(phase, start)     do { (void)(start); } while (0)
+#endif
+
+/* ==================== OLED FUNCTIONS ==================== */
+/*
+ * The panel itself is driven by etx_core: full init table, reset line,
+ * supplies and a diffing, batched framebuffer flush.
+ */
 
 static int etx_oled_probe(struct i2c_client *client)
 {
+    ktime_t start;
+    int ret;
+
     etx_i2c_client_oled = client;
-    pr_info("ETX_OLED: Device probed successfully\n");
-    SSD1306_DisplayInit();
-    SSD1306_Fill(0xFF);
+
+    ret = etx_oled_attach(client);
+    if (ret)
+        return ret;
+
+    start = ktime_get();
+    ret = etx_oled_power_on();
+    etx_phase_end(ETX_PHASE_DISPLAY_INIT, start);
+    if (ret) {
+        pr_err("ETX_OLED: Power-up failed (%d)\n", ret);
+        etx_oled_detach();
+        return ret;
+    }
+    pr_info("ETX_OLED: Device probed successfully, power-up took %u us\n",
+            etx_oled_powerup_us());
+
+    // The panel keeps the pattern; the framebuffer is released after the grace period
+    start = ktime_get();
+    if (!etx_oled_get()) {
+        etx_oled_fill(0xFF);
+        etx_oled_put();
+    }
+    etx_phase_end(ETX_PHASE_FILL, start);
     return 0;
 }
 
 static void etx_oled_remove(struct i2c_client *client)
 {
-    SSD1306_Fill(0x00);
+    if (!etx_oled_get()) {
+        etx_oled_fill(0x00);
+        etx_oled_put();
+    }
+    etx_oled_power_off();
+    etx_oled_detach();
     pr_info("ETX_OLED: Device removed\n");
 }
 
@@ -119,44 +150,24 @@ static struct i2c_board_info oled_i2c_board_info = {
 
 static int AHT20_Init(void)
 {
-    int ret;
-    unsigned char cmd[3] = {0xBE, 0x08, 0x00}; // initialization command
-    ret = i2c_master_send(etx_i2c_client_aht, cmd, 3);
+    int ret = etx_aht20_init(etx_i2c_client_aht);
+
     if (ret < 0)
         pr_err("AHT20: Initialization failed\n");
     else
         pr_info("AHT20: Initialized successfully\n");
-    msleep(40);
     return ret;
 }
 
 static int AHT20_ReadData(int *temperature, int *humidity)
 {
-    unsigned char cmd = 0xAC;
-    unsigned char data[6];
-    int ret;
+    int ret = etx_aht20_measure(etx_i2c_client_aht, temperature, humidity);
 
-    cmd = 0xAC;
-    unsigned char trigger_cmd[3] = {0xAC, 0x33, 0x00};
-    ret = i2c_master_send(etx_i2c_client_aht, trigger_cmd, 3);
     if (ret < 0) {
-        pr_err("AHT20: Trigger measurement failed\n");
+        pr_err("AHT20: Measurement failed\n");
         return ret;
     }
 
-    msleep(80);
-    ret = i2c_master_recv(etx_i2c_client_aht, data, 6);
-    if (ret < 0) {
-        pr_err("AHT20: Data read failed\n");
-        return ret;
-    }
-
-    u32 raw_humidity = ((data[1] << 12) | (data[2] << 4) | (data[3] >> 4));
-    u32 raw_temperature = (((data[3] & 0x0F) << 16) | (data[4] << 8) | data[5]);
-
-    *humidity = (raw_humidity * 1000) / 1048576;
-    *temperature = ((raw_temperature * 2000) / 1048576) - 500;
-
     pr_info("AHT20: Temp = %d.%d°C, RH = %d.%d%%\n",
             *temperature / 10, *temperature % 10,
             *humidity / 10, *humidity % 10);
@@ -167,10 +178,17 @@ static int AHT20_ReadData(int *temperature, int *humidity)
 static int aht20_probe(struct i2c_client *client)
 {
     int temp, hum;
+    ktime_t start;
     etx_i2c_client_aht = client;
     pr_info("AHT20: Device probed successfully\n");
+
+    start = ktime_get();
     AHT20_Init();
+    etx_phase_end(ETX_PHASE_AHT20_INIT, start);
+
+    start = ktime_get();
     AHT20_ReadData(&temp, &hum);
+    etx_phase_end(ETX_PHASE_AHT20_READ, start);
     return 0;
 }
 
@@ -209,13 +227,17 @@ static int __init etx_driver_init(void)
 {
     struct i2c_client *client_oled;
     struct i2c_client *client_aht;
+    ktime_t init_start = ktime_get();
+    ktime_t start;
 
     pr_info("ETX_I2C: Module init started (select_device = %d)\n", select_device);
     
     /* Print kernel message for user-selected device */
     printk(KERN_INFO "ETX_I2C: Selected device = %d\n", select_device);
 
+    start = ktime_get();
     etx_i2c_adapter = i2c_get_adapter(I2C_BUS_AVAILABLE);
+    etx_phase_end(ETX_PHASE_ADAPTER, start);
     if (!etx_i2c_adapter) {
         pr_err("ETX_I2C: Cannot get I2C adapter %d\n", I2C_BUS_AVAILABLE);
         return -ENODEV;
@@ -223,8 +245,12 @@ static int __init etx_driver_init(void)
 
     /* Initialize OLED if selected or both */
     if (select_device == 0 || select_device == 1) {
+        start = ktime_get();
+        etx_oled_board_add(I2C_BUS_AVAILABLE, SSD1306_SLAVE_ADDR);
         client_oled = i2c_new_client_device(etx_i2c_adapter, &oled_i2c_board_info);
+        etx_phase_end(ETX_PHASE_CLIENTS, start);
         if (IS_ERR(client_oled)) {
+            etx_oled_board_remove();
             pr_err("ETX_OLED: Failed to register OLED device\n");
         } else {
             etx_i2c_client_oled = client_oled;
@@ -235,7 +261,9 @@ static int __init etx_driver_init(void)
 
     /* Initialize AHT20 if selected or both */
     if (select_device == 0 || select_device == 2) {
+        start = ktime_get();
         client_aht = i2c_new_client_device(etx_i2c_adapter, &aht20_i2c_board_info);
+        etx_phase_end(ETX_PHASE_CLIENTS, start);
         if (IS_ERR(client_aht)) {
             pr_err("AHT20: Failed to register AHT20 device\n");
         } else {
@@ -246,12 +274,24 @@ static int __init etx_driver_init(void)
     }
     
     i2c_put_adapter(etx_i2c_adapter);
+    etx_phase_end(ETX_PHASE_TOTAL, init_start);
+
+#if ETX_TIMING
+    /* Phase timings: cat /sys/kernel/debug/etx_i2c/timing */
+    etx_debugfs = debugfs_create_dir("etx_i2c", NULL);
+    debugfs_create_file("timing", 0444, etx_debugfs, NULL, &etx_timing_fops);
+#endif
+
     printk(KERN_ALERT "ETX_I2C: Module loaded and visible on console!\n");
     return 0;
 }
 
 static void __exit etx_driver_exit(void)
 {
+#if ETX_TIMING
+    debugfs_remove_recursive(etx_debugfs);
+#endif
+
     if (etx_i2c_client_aht) {
         i2c_unregister_device(etx_i2c_client_aht);
         i2c_del_driver(&aht20_driver);
@@ -259,6 +299,7 @@ static void __exit etx_driver_exit(void)
     }
 
     i2c_unregister_device(etx_i2c_client_oled);
+    etx_oled_board_remove();
     i2c_del_driver(&etx_oled_driver);
     pr_info("ETX_OLED: Driver removed\n");
 }